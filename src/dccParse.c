@@ -0,0 +1,558 @@
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  P A R S E . C                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ *  Copyright (c) 2023 Chris Knight                                                                                   *
+ *                                                                                                                    *
+ *  File dccParse.c part of TrainControl is free software: you can redistribute it and/or modify it under the terms   *
+ *  of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,  *
+ *  or (at your option) any later version.                                                                            *
+ *                                                                                                                    *
+ *  TrainControl is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the        *
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for  *
+ *  more details.                                                                                                     *
+ *                                                                                                                    *
+ *  You should have received a copy of the GNU General Public License along with this program. If not, see:           *
+ *  <http://www.gnu.org/licenses/>                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \file
+ *  \brief Shared parser for the DCC++ style <...> messages.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dccParse.h"
+
+#define DCC_OTHER		0
+#define DCC_LETTER		1
+#define DCC_DIGIT		2
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  C H A R  T Y P E                                                                                           *
+ *  =======================                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Work out what sort of character we have, a change of type starts a new word.
+ *  \param inChar Character to check.
+ *  \result DCC_LETTER, DCC_DIGIT or DCC_OTHER.
+ */
+static int dccCharType (char inChar)
+{
+	if ((inChar >= 'a' && inChar <= 'z') || (inChar >= 'A' && inChar <= 'Z'))
+		return DCC_LETTER;
+	if ((inChar >= '0' && inChar <= '9') || inChar == '-' || inChar == '.')
+		return DCC_DIGIT;
+	return DCC_OTHER;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  D I S P A T C H  I N I T                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Register a command table, building a route for every opcode and word count so a message can be handed
+ *  to its handler with one lookup. Where commands overlap the first one in the table wins.
+ *  \param dispatch Dispatcher to set up.
+ *  \param commands Table of commands, ending with an opcode of 0 whose handler (if any) gets everything else.
+ *  \result Number of commands registered, -1 if the table is too long.
+ */
+int dccDispatchInit (dccDispatchDef *dispatch, dccCommandDef *commands)
+{
+	int c, w;
+
+	memset (dispatch, 0, sizeof (dccDispatchDef));
+	dispatch -> commands = commands;
+
+	for (c = 0; commands[c].opcode; ++c)
+	{
+		int maxWords = commands[c].maxWords;
+		unsigned char opcode = (unsigned char)commands[c].opcode;
+
+		if (c >= 255)
+		{
+			dispatch -> commands = NULL;
+			return -1;
+		}
+		if (maxWords == -1 || maxWords > DCC_MAX_WORDS)
+			maxWords = DCC_MAX_WORDS;
+
+		for (w = commands[c].minWords < 1 ? 1 : commands[c].minWords; w <= maxWords; ++w)
+		{
+			if (dispatch -> routes[opcode][w] == 0)
+				dispatch -> routes[opcode][w] = c + 1;
+		}
+	}
+	dispatch -> passOn = &commands[c];
+	return c;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  D I S P A T C H                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Look up the route for the opcode and word count and call the handler. Anything without a route goes to
+ *  the default handler, both are counted by opcode.
+ *  \param dispatch Dispatcher to use.
+ *  \param message Message to dispatch.
+ *  \param handle Passed on to the handler.
+ *  \param userData Passed on to the handler.
+ *  \result None.
+ */
+static void dccDispatch (dccDispatchDef *dispatch, dccMessageDef *message, int handle, void *userData)
+{
+	dccCommandDef *command;
+	unsigned char opcode = 0, route = 0;
+
+	if (message -> wordCount > 0)
+	{
+		opcode = (unsigned char)message -> words[0].ptr[0];
+		if (message -> words[0].len == 1)
+			route = dispatch -> routes[opcode][message -> wordCount];
+	}
+	if (route)
+	{
+		++dispatch -> handled[opcode];
+		command = &dispatch -> commands[route - 1];
+	}
+	else
+	{
+		++dispatch -> passedOn[opcode];
+		command = dispatch -> passOn;
+	}
+	if (command != NULL && command -> handler != NULL)
+		command -> handler (message, handle, userData);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  F R A M E  L E N G T H                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check the length of a binary frame, the length byte must allow for the opcode and whole numbers.
+ *  \param buffer Buffer starting with the frame start byte.
+ *  \param len Bytes available in the buffer.
+ *  \result Length of the whole frame, 0 if it has not all arrived, -1 if it is not a valid frame.
+ */
+int dccFrameLength (char *buffer, int len)
+{
+	int frameLen;
+
+	if (len < 2)
+		return 0;
+
+	frameLen = (unsigned char)buffer[1];
+	if (frameLen < 1 || frameLen > 1 + (DCC_FRAME_FIELDS * 2) || !(frameLen & 1))
+		return -1;
+
+	return len < frameLen + 2 ? 0 : frameLen + 2;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  F R A M E  D I S P A T C H                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Unpack a binary frame into a message and dispatch it. The opcode is word 0 as it is for text, the
+ *  numbers are kept in the values so they do not need to be read again.
+ *  \param dispatch Dispatcher to pass the message to.
+ *  \param buffer Buffer starting with the frame start byte.
+ *  \param frameLen Length of the whole frame.
+ *  \param handle Passed on to the handler.
+ *  \param userData Passed on to the handler.
+ *  \result None.
+ */
+static void dccFrameDispatch (dccDispatchDef *dispatch, char *buffer, int frameLen, int handle, void *userData)
+{
+	int w;
+	dccMessageDef message;
+
+	message.msgStart = buffer;
+	message.msgLen = frameLen;
+	message.binary = 1;
+	message.wordCount = 1 + ((frameLen - 3) / 2);
+	message.words[0].ptr = &buffer[2];
+	message.words[0].len = 1;
+
+	for (w = 1; w < message.wordCount; ++w)
+	{
+		unsigned char *field = (unsigned char *)&buffer[1 + (w * 2)];
+
+		message.values[w] = (short)((field[0] << 8) | field[1]);
+		message.words[w].ptr = NULL;
+		message.words[w].len = 0;
+	}
+	dccDispatch (dispatch, &message, handle, userData);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  P A R S E  B U F F E R                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Split each complete message in the buffer into words and dispatch it. Words are a letter or a number
+ *  run, split by a change between the two or by a space or '|'. The words point back into the buffer, nothing is
+ *  copied. Binary frames are unpacked and dispatched in the same way.
+ *  \param dispatch Dispatcher to pass the messages to.
+ *  \param buffer Buffer to parse.
+ *  \param len Length of the buffer.
+ *  \param handle Passed on to the handler.
+ *  \param userData Passed on to the handler.
+ *  \result Number of bytes used, anything after that is the start of an incomplete message.
+ */
+int dccParseBuffer (dccDispatchDef *dispatch, char *buffer, int len, int handle, void *userData)
+{
+	dccMessageDef message;
+	int i, used = 0, inType = DCC_OTHER;
+
+	message.wordCount = -1;
+	message.binary = 0;
+	for (i = 0; i < len; ++i)
+	{
+		if (message.wordCount == -1)
+		{
+			if (buffer[i] == '<')
+			{
+				message.msgStart = &buffer[i];
+				message.wordCount = 0;
+				inType = DCC_OTHER;
+			}
+			else if (buffer[i] == DCC_FRAME_START)
+			{
+				int frameLen = dccFrameLength (&buffer[i], len - i);
+
+				if (frameLen == 0)
+					break;
+				if (frameLen > 0)
+				{
+					dccFrameDispatch (dispatch, &buffer[i], frameLen, handle, userData);
+					i += frameLen - 1;
+				}
+				used = i + 1;
+			}
+			else
+			{
+				used = i + 1;
+			}
+		}
+		else if (buffer[i] == '>')
+		{
+			if (inType != DCC_OTHER && message.wordCount < DCC_MAX_WORDS)
+				++message.wordCount;
+
+			message.msgLen = &buffer[i] - message.msgStart + 1;
+			dccDispatch (dispatch, &message, handle, userData);
+			message.wordCount = -1;
+			used = i + 1;
+		}
+		else if (buffer[i] == ' ' || buffer[i] == '|')
+		{
+			if (inType != DCC_OTHER && message.wordCount < DCC_MAX_WORDS)
+				++message.wordCount;
+
+			inType = DCC_OTHER;
+		}
+		else
+		{
+			int charType = dccCharType (buffer[i]);
+			if (charType != DCC_OTHER)
+			{
+				dccWordDef *word;
+				if (inType != DCC_OTHER && inType != charType && message.wordCount < DCC_MAX_WORDS)
+					++message.wordCount;
+
+				word = &message.words[message.wordCount];
+				if (inType != charType)
+					word -> ptr = &buffer[i];
+
+				word -> len = &buffer[i] - word -> ptr + 1;
+				inType = charType;
+			}
+		}
+	}
+	return used;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  S T R E A M  D O N E                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check if the partial message kept in the stream is now complete.
+ *  \param stream Stream to check.
+ *  \result 1 if it is complete (or is a frame that is not valid), 0 if there is more to come.
+ */
+static int dccStreamDone (dccStreamDef *stream)
+{
+	if (stream -> buffer[0] == DCC_FRAME_START)
+		return dccFrameLength (stream -> buffer, stream -> posn) != 0;
+
+	return stream -> buffer[stream -> posn - 1] == '>';
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  P A R S E  S T R E A M                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Parse data as it arrives, keeping any incomplete message until the rest turns up. Complete messages are
+ *  parsed where they are, only a partial message is copied, and the stream buffer is only allocated when needed.
+ *  \param stream Stream that the data arrived on.
+ *  \param dispatch Dispatcher to pass the messages to.
+ *  \param buffer Data that was received.
+ *  \param len Length of the data.
+ *  \param handle Passed on to the handler.
+ *  \param userData Passed on to the handler.
+ *  \result None.
+ */
+void dccParseStream (dccStreamDef *stream, dccDispatchDef *dispatch, char *buffer, int len, int handle, void *userData)
+{
+	int used = 0;
+
+	/* Finish off the message left from last time */
+	if (stream -> posn > 0)
+	{
+		while (used < len && stream -> posn < stream -> size)
+		{
+			stream -> buffer[stream -> posn++] = buffer[used++];
+			if (dccStreamDone (stream))
+				break;
+		}
+		if (dccStreamDone (stream))
+		{
+			dccParseBuffer (dispatch, stream -> buffer, stream -> posn, handle, userData);
+			stream -> posn = 0;
+		}
+		else if (stream -> posn == stream -> size)
+		{
+			stream -> posn = 0;
+		}
+	}
+	if (used < len)
+	{
+		used += dccParseBuffer (dispatch, &buffer[used], len - used, handle, userData);
+		if (used < len && len - used <= stream -> size)
+		{
+			if (stream -> buffer == NULL)
+				stream -> buffer = (char *)malloc (stream -> size + 1);
+
+			if (stream -> buffer != NULL)
+			{
+				memcpy (stream -> buffer, &buffer[used], len - used);
+				stream -> posn = len - used;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  S T R E A M  I N I T                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Set up a stream, the buffer is allocated when it is first needed.
+ *  \param stream Stream to set up.
+ *  \param size Longest message that can be kept.
+ *  \result None.
+ */
+void dccStreamInit (dccStreamDef *stream, int size)
+{
+	stream -> buffer = NULL;
+	stream -> size = size;
+	stream -> posn = 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  S T R E A M  F R E E                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Release the stream buffer and forget any partial message.
+ *  \param stream Stream to free.
+ *  \result None.
+ */
+void dccStreamFree (dccStreamDef *stream)
+{
+	if (stream -> buffer != NULL)
+	{
+		free (stream -> buffer);
+		stream -> buffer = NULL;
+	}
+	stream -> posn = 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  W O R D  I N T                                                                                             *
+ *  =====================                                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read a number straight out of a word, like atoi but without needing a terminated copy.
+ *  \param message Message containing the word.
+ *  \param word Which word to read.
+ *  \result The value, 0 if the word is missing or not a number.
+ */
+int dccWordInt (dccMessageDef *message, int word)
+{
+	int i = 0, negative = 0;
+	unsigned int value = 0;
+
+	if (word < 0 || word >= message -> wordCount)
+		return 0;
+
+	if (message -> binary)
+		return word > 0 ? message -> values[word] : 0;
+
+	if (message -> words[word].len > 0 && message -> words[word].ptr[0] == '-')
+	{
+		negative = 1;
+		++i;
+	}
+	for (; i < message -> words[word].len; ++i)
+	{
+		char digit = message -> words[word].ptr[i];
+		if (digit < '0' || digit > '9')
+			break;
+		value = (value * 10) + (digit - '0');
+	}
+	return (int)(negative ? -value : value);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  W O R D  C O P Y                                                                                           *
+ *  =======================                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Copy a word out as a terminated string.
+ *  \param message Message containing the word.
+ *  \param word Which word to copy.
+ *  \param outBuff Where to copy to.
+ *  \param size Size of the out buffer.
+ *  \result Pointer to the out buffer.
+ */
+char *dccWordCopy (dccMessageDef *message, int word, char *outBuff, int size)
+{
+	int len = 0;
+
+	if (message -> binary && word > 0 && word < message -> wordCount)
+	{
+		snprintf (outBuff, size, "%d", message -> values[word]);
+		return outBuff;
+	}
+	if (word >= 0 && word < message -> wordCount)
+	{
+		len = message -> words[word].len;
+		if (len > size - 1)
+			len = size - 1;
+		memcpy (outBuff, message -> words[word].ptr, len);
+	}
+	outBuff[len] = 0;
+	return outBuff;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  F O R M A T                                                                                                *
+ *  ==================                                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Build a message from an opcode and numbers, as a binary frame if the other end has asked for them or as
+ *  text if not. Anything that will not fit in a frame is always sent as text.
+ *  \param outBuff Where to build the message, at least DCC_FORMAT_SIZE bytes.
+ *  \param frames Non-zero to build a binary frame.
+ *  \param opcode Opcode of the message.
+ *  \param count Number of values, no more than DCC_FRAME_FIELDS.
+ *  \param values Values to add after the opcode.
+ *  \result Length of the message.
+ */
+int dccFormat (char *outBuff, int frames, char opcode, int count, int *values)
+{
+	int i, len;
+
+	if (count > DCC_FRAME_FIELDS)
+		count = DCC_FRAME_FIELDS;
+
+	if (frames)
+	{
+		for (i = 0; i < count && values[i] >= -32768 && values[i] <= 32767; ++i)
+			;
+		if (i == count)
+		{
+			outBuff[0] = DCC_FRAME_START;
+			outBuff[1] = 1 + (count * 2);
+			outBuff[2] = opcode;
+			for (i = 0; i < count; ++i)
+			{
+				outBuff[3 + (i * 2)] = (values[i] >> 8) & 0xFF;
+				outBuff[4 + (i * 2)] = values[i] & 0xFF;
+			}
+			return 3 + (count * 2);
+		}
+	}
+	len = sprintf (outBuff, "<%c", opcode);
+	for (i = 0; i < count; ++i)
+		len += sprintf (&outBuff[len], " %d", values[i]);
+
+	outBuff[len++] = '>';
+	outBuff[len] = 0;
+	return len;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  M E S S A G E  F O R M                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get a message in the form wanted by where it is going, it is only rebuilt if it arrived in the other
+ *  form. Only for messages that are an opcode followed by numbers.
+ *  \param message Message to get.
+ *  \param frames Non-zero for a binary frame, zero for text.
+ *  \param outBuff Where to build it if needed, at least DCC_FORMAT_SIZE bytes.
+ *  \param len Set to the length of the message.
+ *  \result Pointer to the message in the form wanted (or as it is if it does not fit a frame).
+ */
+char *dccMessageForm (dccMessageDef *message, int frames, char *outBuff, int *len)
+{
+	int w, values[DCC_FRAME_FIELDS];
+
+	if (!message -> binary == !frames || message -> wordCount < 1 || message -> wordCount > DCC_FRAME_FIELDS + 1)
+	{
+		*len = message -> msgLen;
+		return message -> msgStart;
+	}
+	for (w = 1; w < message -> wordCount; ++w)
+		values[w - 1] = dccWordInt (message, w);
+
+	*len = dccFormat (outBuff, frames, message -> words[0].ptr[0], message -> wordCount - 1, values);
+	return outBuff;
+}
@@ -0,0 +1,101 @@
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D C C  P A R S E . H                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ *  Copyright (c) 2023 Chris Knight                                                                                   *
+ *                                                                                                                    *
+ *  File dccParse.h part of TrainControl is free software: you can redistribute it and/or modify it under the terms   *
+ *  of the GNU General Public License as published by the Free Software Foundation, either version 3 of the License,  *
+ *  or (at your option) any later version.                                                                            *
+ *                                                                                                                    *
+ *  TrainControl is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the        *
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for  *
+ *  more details.                                                                                                     *
+ *                                                                                                                    *
+ *  You should have received a copy of the GNU General Public License along with this program. If not, see:           *
+ *  <http://www.gnu.org/licenses/>                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \file
+ *  \brief Shared parser for the DCC++ style <...> messages.
+ */
+#ifndef DCC_PARSE_H
+#define DCC_PARSE_H
+
+#define DCC_MAX_WORDS	40
+
+/*----------------------------------------------------------------------------------------------------*
+ * Our own programs can agree to use binary frames for the busy messages. A frame is a start byte, a  *
+ * length byte (what follows it), the opcode, then up to four 16 bit big endian numbers. It is asked  *
+ * for by sending <K version>, the other end replies with the version it will use. Both forms can be  *
+ * mixed on the same stream, the serial link to DCC++ is always text.                                 *
+ *----------------------------------------------------------------------------------------------------*/
+#define DCC_FRAME_START		0x01
+#define DCC_FRAME_OPCODE	'K'
+#define DCC_FRAME_VERSION	1
+#define DCC_FRAME_FIELDS	4
+#define DCC_FRAME_SIZE		(3 + (DCC_FRAME_FIELDS * 2))
+#define DCC_FORMAT_SIZE		81
+
+typedef struct _dccWord
+{
+	char *ptr;
+	int len;
+}
+dccWordDef;
+
+typedef struct _dccMessage
+{
+	char *msgStart;
+	int msgLen;
+	int wordCount;
+	int binary;
+	dccWordDef words[DCC_MAX_WORDS + 1];
+	int values[DCC_FRAME_FIELDS + 1];
+}
+dccMessageDef;
+
+typedef void (*dccHandler) (dccMessageDef *message, int handle, void *userData);
+
+typedef struct _dccCommand
+{
+	char opcode;
+	int minWords;
+	int maxWords;
+	dccHandler handler;
+}
+dccCommandDef;
+
+typedef struct _dccDispatch
+{
+	dccCommandDef *commands;
+	dccCommandDef *passOn;
+	unsigned char routes[256][DCC_MAX_WORDS + 1];
+	unsigned long handled[256];
+	unsigned long passedOn[256];
+}
+dccDispatchDef;
+
+typedef struct _dccStream
+{
+	char *buffer;
+	int size;
+	int posn;
+}
+dccStreamDef;
+
+int dccDispatchInit (dccDispatchDef *dispatch, dccCommandDef *commands);
+int dccFrameLength (char *buffer, int len);
+int dccParseBuffer (dccDispatchDef *dispatch, char *buffer, int len, int handle, void *userData);
+void dccParseStream (dccStreamDef *stream, dccDispatchDef *dispatch, char *buffer, int len, int handle, void *userData);
+void dccStreamInit (dccStreamDef *stream, int size);
+void dccStreamFree (dccStreamDef *stream);
+int dccWordInt (dccMessageDef *message, int word);
+char *dccWordCopy (dccMessageDef *message, int word, char *outBuff, int size);
+int dccFormat (char *outBuff, int frames, char opcode, int count, int *values);
+char *dccMessageForm (dccMessageDef *message, int frames, char *outBuff, int *len);
+
+#endif
+
@@ -22,6 +22,7 @@
  */
 #include "config.h"
 #ifdef HAVE_WIRINGPI_H
+#include <unistd.h>
 #include <wiringPi.h>
 #include <wiringPiI2C.h>
 
@@ -36,6 +37,21 @@
 #define LEDALL_ON_L 0xFA
 
 #define PIN_ALL 16
+#define FULL_BIT 0x1000
+
+// Shadow copy of the LEDn registers for each chip so full on/off need no reads
+#define PCA9685_CHIPS 4
+
+typedef struct _pca9685Shadow
+{
+	int fd;
+	unsigned short on[PIN_ALL];
+	unsigned short off[PIN_ALL];
+}
+pca9685ShadowDef;
+
+static pca9685ShadowDef shadowRegs[PCA9685_CHIPS];
+static int shadowCount = 0;
 
 // Declare
 static void myPwmWrite(struct wiringPiNodeStruct *node, int pin, int value);
@@ -43,6 +59,8 @@ static void myOnOffWrite(struct wiringPiNodeStruct *node, int pin, int value);
 static int myOffRead(struct wiringPiNodeStruct *node, int pin);
 static int myOnRead(struct wiringPiNodeStruct *node, int pin);
 int baseReg(int pin);
+static void shadowLoad(int fd);
+static void writeRun(int fd, pca9685ShadowDef *shadow, int pin, int count, int *on, int *off);
 
 /**********************************************************************************************************************
  *                                                                                                                    *
@@ -75,6 +93,7 @@ int pca9685Setup(const int pinBase, const int i2cAddress, float freq)
 			int autoInc = settings | 0x20;
 
 			wiringPiI2CWriteReg8(fd, PCA9685_MODE1, autoInc);
+			shadowLoad(fd);
 
 			// Set frequency of PWM signals. Also ends sleep mode and starts PWM output.
 			if (freq > 0)
@@ -91,6 +110,150 @@ int pca9685Setup(const int pinBase, const int i2cAddress, float freq)
 	return fd;
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S H A D O W  F I N D                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find the shadow registers for a chip.
+ *  \param fd File handle of the i2c interface.
+ *  \result Shadow registers, NULL if the chip was not set up here.
+ */
+static pca9685ShadowDef *shadowFind(int fd)
+{
+	int i;
+
+	for (i = 0; i < shadowCount; ++i)
+	{
+		if (shadowRegs[i].fd == fd)
+			return &shadowRegs[i];
+	}
+	return NULL;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S H A D O W  L O A D                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read all the LEDn registers once, in one auto-increment read, to fill the shadow for a new chip.
+ *  \param fd File handle of the i2c interface.
+ *  \result None.
+ */
+static void shadowLoad(int fd)
+{
+	int i;
+	unsigned char reg = LED0_ON_L, buff[PIN_ALL * 4];
+	pca9685ShadowDef *shadow = shadowFind(fd);
+
+	if (shadow == NULL)
+	{
+		if (shadowCount == PCA9685_CHIPS)
+			return;
+		shadow = &shadowRegs[shadowCount++];
+		shadow->fd = fd;
+	}
+	if (write(fd, &reg, 1) == 1 && read(fd, buff, sizeof(buff)) == sizeof(buff))
+	{
+		for (i = 0; i < PIN_ALL; ++i)
+		{
+			shadow->on[i] = buff[i * 4] | (buff[(i * 4) + 1] << 8);
+			shadow->off[i] = buff[(i * 4) + 2] | (buff[(i * 4) + 3] << 8);
+		}
+	}
+	else
+	{
+		// Could not read, assume the power on state of all off
+		for (i = 0; i < PIN_ALL; ++i)
+		{
+			shadow->on[i] = 0;
+			shadow->off[i] = FULL_BIT;
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  W R I T E  R U N                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send the ON and OFF registers for a run of pins in one write, then update the shadow registers.
+ *  \param fd File handle of the i2c interface.
+ *  \param shadow Shadow registers for the chip, may be NULL.
+ *  \param pin First pin to write, PIN_ALL writes all the pins.
+ *  \param count Number of pins in the run.
+ *  \param on Values for the ON registers.
+ *  \param off Values for the OFF registers.
+ *  \result None.
+ */
+static void writeRun(int fd, pca9685ShadowDef *shadow, int pin, int count, int *on, int *off)
+{
+	int i, j, len = 1;
+	unsigned char buff[1 + (PIN_ALL * 4)];
+
+	buff[0] = baseReg(pin);
+	for (i = 0; i < count; ++i)
+	{
+		buff[len++] = on[i] & 0xFF;
+		buff[len++] = (on[i] >> 8) & 0x1F;
+		buff[len++] = off[i] & 0xFF;
+		buff[len++] = (off[i] >> 8) & 0x1F;
+	}
+	if (write(fd, buff, len) != len)
+		return;
+
+	if (shadow != NULL)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			if (pin >= PIN_ALL)
+			{
+				for (j = 0; j < PIN_ALL; ++j)
+				{
+					shadow->on[j] = on[i] & 0x1FFF;
+					shadow->off[j] = off[i] & 0x1FFF;
+				}
+			}
+			else
+			{
+				shadow->on[pin + i] = on[i] & 0x1FFF;
+				shadow->off[pin + i] = off[i] & 0x1FFF;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S H A D O W  H I G H                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check if the high byte of a register already holds a value, for PIN_ALL every pin must hold it.
+ *  \param regs Shadow ON or OFF registers.
+ *  \param pin Pin to check.
+ *  \param state Value of the high byte.
+ *  \result 1 if the write can be skipped.
+ */
+static int shadowHigh(unsigned short *regs, int pin, int state)
+{
+	int i;
+
+	for (i = 0; i < PIN_ALL; ++i)
+	{
+		if ((pin >= PIN_ALL || pin == i) && (regs[i] >> 8) != state)
+			return 0;
+	}
+	return 1;
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P C A 9 6 8 5 P W M F R E Q                                                                                       *
@@ -147,8 +310,9 @@ void pca9685PWMFreq(int fd, float freq)
  */
 void pca9685PWMReset(int fd)
 {
-	wiringPiI2CWriteReg16 (fd, LEDALL_ON_L, 0x0);
-	wiringPiI2CWriteReg16 (fd, LEDALL_ON_L + 2, 0x1000);
+	int on = 0, off = FULL_BIT;
+
+	pca9685PWMWriteRange (fd, PIN_ALL, 1, &on, &off);
 }
 
 /**********************************************************************************************************************
@@ -168,8 +332,115 @@ void pca9685PWMReset(int fd)
 void pca9685PWMWrite(int fd, int pin, int on, int off)
 {
 	// Write to on and off registers and mask the 12 lowest bits of data to overwrite full-on and off
-	wiringPiI2CWriteReg16 (fd, baseReg (pin), on & 0x0FFF);
-	wiringPiI2CWriteReg16 (fd, baseReg (pin) + 2, off & 0x0FFF);
+	on &= 0x0FFF;
+	off &= 0x0FFF;
+	pca9685PWMWriteRange (fd, pin, 1, &on, &off);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  P C A 9 6 8 5 P W M  W R I T E  R A N G E                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Write the ON and OFF registers of a run of pins in one I2C transaction, using the auto-increment set up
+ *  in pca9685Setup. Pins that already hold the value in the shadow registers are not written, a single unchanged
+ *  pin between two changed ones is sent anyway to save starting another transaction. The values are written as
+ *  given so the full on and off bits can be set.
+ *  \param fd File handle of the i2c interface.
+ *  \param pin First pin to write, PIN_ALL writes all the pins.
+ *  \param count Number of pins in the run.
+ *  \param on Values for the ON registers.
+ *  \param off Values for the OFF registers.
+ *  \result None.
+ */
+void pca9685PWMWriteRange(int fd, int pin, int count, int *on, int *off)
+{
+	int i, first = -1, last = -1;
+	pca9685ShadowDef *shadow = shadowFind(fd);
+
+	if (pin < 0 || count < 1)
+		return;
+	if (pin >= PIN_ALL)
+		count = 1;
+	else if (pin + count > PIN_ALL)
+		count = PIN_ALL - pin;
+
+	if (shadow == NULL)
+	{
+		writeRun(fd, NULL, pin, count, on, off);
+	}
+	else if (pin >= PIN_ALL)
+	{
+		for (i = 0; i < PIN_ALL; ++i)
+		{
+			if (shadow->on[i] != (on[0] & 0x1FFF) || shadow->off[i] != (off[0] & 0x1FFF))
+			{
+				writeRun(fd, shadow, pin, 1, on, off);
+				break;
+			}
+		}
+	}
+	else
+	{
+		for (i = 0; i <= count; ++i)
+		{
+			if (i < count && (shadow->on[pin + i] != (on[i] & 0x1FFF) || shadow->off[pin + i] != (off[i] & 0x1FFF)))
+			{
+				if (first == -1)
+					first = i;
+				last = i;
+			}
+			else if (first != -1 && (i == count || i - last > 1))
+			{
+				writeRun(fd, shadow, pin + first, (last - first) + 1, &on[first], &off[first]);
+				first = -1;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  P C A 9 6 8 5 P W M  V A L U E S                                                                                  *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Write pwmWrite style values to a run of pins in one I2C transaction.
+ *  \param fd File handle of the i2c interface.
+ *  \param pin First pin to write.
+ *  \param count Number of pins in the run.
+ *  \param values Value for each pin, 0 or less for full off, 4096 or more for full on.
+ *  \result None.
+ */
+void pca9685PWMValues(int fd, int pin, int count, int *values)
+{
+	int i, on[PIN_ALL], off[PIN_ALL];
+
+	if (count > PIN_ALL)
+		count = PIN_ALL;
+
+	for (i = 0; i < count; ++i)
+	{
+		if (values[i] >= 4096)
+		{
+			on[i] = FULL_BIT;
+			off[i] = 0;
+		}
+		else if (values[i] > 0)
+		{
+			on[i] = 0;
+			off[i] = values[i];
+		}
+		else
+		{
+			on[i] = 0;
+			off[i] = FULL_BIT;
+		}
+	}
+	pca9685PWMWriteRange (fd, pin, count, on, off);
 }
 
 /**********************************************************************************************************************
@@ -198,6 +469,38 @@ void pca9685PWMRead(int fd, int pin, int *on, int *off)
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  P C A 9 6 8 5 P W M  R E A D  S H A D O W                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read the registers from the shadow copy so the bus is not used. The ALL_LED pin always gives 0.
+ *  \param fd File handle of the interface.
+ *  \param pin Pin to read from.
+ *  \param on Return on value.
+ *  \param off Return off value.
+ *  \result 1 if the chip has a shadow copy, 0 if the registers must be read from the bus.
+ */
+int pca9685PWMReadShadow(int fd, int pin, int *on, int *off)
+{
+	pca9685ShadowDef *shadow = shadowFind(fd);
+
+	if (shadow == NULL)
+		return 0;
+
+	if (on)
+	{
+		*on = pin >= PIN_ALL ? 0 : shadow->on[pin];
+	}
+	if (off)
+	{
+		*off = pin >= PIN_ALL ? 0 : shadow->off[pin];
+	}
+	return 1;
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P C A 9 6 8 5 F U L L  O N                                                                                        *
@@ -213,12 +516,21 @@ void pca9685PWMRead(int fd, int pin, int *on, int *off)
  */
 void pca9685FullOn(int fd, int pin, int tf)
 {
-	int reg = baseReg(pin) + 1;		// LEDX_ON_H
-	int state = wiringPiI2CReadReg8(fd, reg);
+	int i, reg = baseReg(pin) + 1;		// LEDX_ON_H
+	pca9685ShadowDef *shadow = shadowFind(fd);
+	int state = shadow == NULL ? wiringPiI2CReadReg8(fd, reg) : pin >= PIN_ALL ? 0 : shadow->on[pin] >> 8;
 
 	// Set bit 4 to 1 or 0 accordingly
 	state = tf ? (state | 0x10) : (state & 0xEF);
-	wiringPiI2CWriteReg8 (fd, reg, state);
+	if (shadow == NULL || !shadowHigh(shadow->on, pin, state))
+	{
+		wiringPiI2CWriteReg8 (fd, reg, state);
+		for (i = 0; shadow != NULL && i < PIN_ALL; ++i)
+		{
+			if (pin >= PIN_ALL || pin == i)
+				shadow->on[i] = (shadow->on[i] & 0xFF) | (state << 8);
+		}
+	}
 
 	// For simplicity, we set full-off to 0 because it has priority over full-on
 	if (tf)
@@ -242,12 +554,21 @@ void pca9685FullOn(int fd, int pin, int tf)
  */
 void pca9685FullOff(int fd, int pin, int tf)
 {
-	int reg = baseReg(pin) + 3;		// LEDX_OFF_H
-	int state = wiringPiI2CReadReg8 (fd, reg);
+	int i, reg = baseReg(pin) + 3;		// LEDX_OFF_H
+	pca9685ShadowDef *shadow = shadowFind(fd);
+	int state = shadow == NULL ? wiringPiI2CReadReg8(fd, reg) : pin >= PIN_ALL ? 0 : shadow->off[pin] >> 8;
 
 	// Set bit 4 to 1 or 0 accordingly
 	state = tf ? (state | 0x10) : (state & 0xEF);
+	if (shadow != NULL && shadowHigh(shadow->off, pin, state))
+		return;
+
 	wiringPiI2CWriteReg8 (fd, reg, state);
+	for (i = 0; shadow != NULL && i < PIN_ALL; ++i)
+	{
+		if (pin >= PIN_ALL || pin == i)
+			shadow->off[i] = (shadow->off[i] & 0xFF) | (state << 8);
+	}
 }
 
 /**********************************************************************************************************************
@@ -281,12 +602,8 @@ int baseReg(int pin)
  */
 static void myPwmWrite(struct wiringPiNodeStruct *node, int pin, int value)
 {
-	if (value >= 4096)
-		pca9685FullOn (node->fd, pin - node->pinBase, 1);
-	else if (value > 0)
-		pca9685PWMWrite (node->fd, pin - node->pinBase, 0, value);	// (Deactivates full-on and off by itself)
-	else
-		pca9685FullOff (node->fd, pin - node->pinBase, 1);
+	// One write with full-on and off set as needed, skipped if the pin already has the value
+	pca9685PWMValues (node->fd, pin - node->pinBase, 1, &value);
 }
 
 /**********************************************************************************************************************
@@ -304,8 +621,8 @@ static void myPwmWrite(struct wiringPiNodeStruct *node, int pin, int value)
  */
 static void myOnOffWrite(struct wiringPiNodeStruct *node, int pin, int value)
 {
-	value ? pca9685FullOn (node->fd, pin - node->pinBase, 1) :
-			pca9685FullOff (node->fd, pin - node->pinBase, 1);
+	value = value ? 4096 : 0;
+	pca9685PWMValues (node->fd, pin - node->pinBase, 1, &value);
 }
 
 /**********************************************************************************************************************
@@ -323,7 +640,8 @@ static void myOnOffWrite(struct wiringPiNodeStruct *node, int pin, int value)
 static int myOffRead(struct wiringPiNodeStruct *node, int pin)
 {
 	int off = 0;
-	pca9685PWMRead (node->fd, pin - node->pinBase, 0, &off);
+	if (!pca9685PWMReadShadow (node->fd, pin - node->pinBase, 0, &off))
+		pca9685PWMRead (node->fd, pin - node->pinBase, 0, &off);
 	return off;
 }
 
@@ -342,7 +660,8 @@ static int myOffRead(struct wiringPiNodeStruct *node, int pin)
 static int myOnRead(struct wiringPiNodeStruct *node, int pin)
 {
 	int on = 0;
-	pca9685PWMRead (node->fd, pin - node->pinBase, &on, 0);
+	if (!pca9685PWMReadShadow (node->fd, pin - node->pinBase, &on, 0))
+		pca9685PWMRead (node->fd, pin - node->pinBase, &on, 0);
 	return on;
 }
 
@@ -53,13 +53,19 @@ extern int pca9685Setup(const int pinBase, const int i2cAddress/* = 0x40*/, floa
 //		To get PWM: mask with 0xFFF
 //		To get full-on bit: mask with 0x1000
 //		Note: ALL_LED pin will always return 0
+//
+// Reads come from a shadow copy of the registers and writes that would not
+// change a pin are skipped, so only real changes use the bus.
 
 // Advanced controls
 // You can use the file descriptor returned from the setup function to access the following features directly on each connected pca9685
 extern void pca9685PWMFreq(int fd, float freq);
 extern void pca9685PWMReset(int fd);
 extern void pca9685PWMWrite(int fd, int pin, int on, int off);
+extern void pca9685PWMWriteRange(int fd, int pin, int count, int *on, int *off);
+extern void pca9685PWMValues(int fd, int pin, int count, int *values);
 extern void pca9685PWMRead(int fd, int pin, int *on, int *off);
+extern int pca9685PWMReadShadow(int fd, int pin, int *on, int *off);
 
 extern void pca9685FullOn(int fd, int pin, int tf);
 extern void pca9685FullOff(int fd, int pin, int tf);
@@ -43,14 +43,52 @@
 #endif
 
 #include "socketC.h"
+#include "dccParse.h"
 #include "servoCtrl.h"
 #include "pointControl.h"
 
 int servoFD = -1;
-int curPriority = 0;
 extern int running;
 pthread_t threadHandle;
-pthread_mutex_t priorityMutex;
+servoQueueDef servoQueue;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  P R O C E S S  P R O F I L E                                                                                      *
+ *  ============================                                                                                      *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read how a servo should move, anything not given keeps the default.
+ *  \param curNode Point or signal node to read.
+ *  \param profile Save the profile here.
+ *  \result None.
+ */
+static void processProfile (xmlNode *curNode, servoProfileDef *profile)
+{
+	xmlChar *tempStr;
+
+	profile -> duration = 0;
+	profile -> profile = SERVO_LINEAR;
+	profile -> overshoot = 0;
+
+	if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"duration")) != NULL)
+	{
+		sscanf ((char *)tempStr, "%d", &profile -> duration);
+		xmlFree (tempStr);
+	}
+	if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"profile")) != NULL)
+	{
+		if (strcmp ((char *)tempStr, "ease") == 0)
+			profile -> profile = SERVO_EASE;
+		xmlFree (tempStr);
+	}
+	if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"overshoot")) != NULL)
+	{
+		sscanf ((char *)tempStr, "%d", &profile -> overshoot);
+		xmlFree (tempStr);
+	}
+}
 
 /**********************************************************************************************************************
  *                                                                                                                    *
@@ -126,6 +164,7 @@ void processPoints (pointCtrlDef *pointCtrl, xmlNode *inNode, int pCount, int sC
 					pointCtrl -> pointStates[pFound].servoChannel = channel;
 					pointCtrl -> pointStates[pFound].defaultPos = defaultPos;
 					pointCtrl -> pointStates[pFound].turnoutPos = turnoutPos;
+					processProfile (curNode, &pointCtrl -> pointStates[pFound].profile);
 					++pFound;
 				}
 			}
@@ -178,6 +217,7 @@ void processPoints (pointCtrlDef *pointCtrl, xmlNode *inNode, int pCount, int sC
 					pointCtrl -> signalStates[sFound].redOut = redOut;
 					pointCtrl -> signalStates[sFound].greenOut = greenOut;
 					pointCtrl -> signalStates[sFound].state = 0;
+					processProfile (curNode, &pointCtrl -> signalStates[sFound].profile);
 					++sFound;
 				}
 			}
@@ -264,7 +304,7 @@ void parseTree(pointCtrlDef *pointCtrl, xmlNode *inNode, int level)
 			}
 			else if (level == 1 && strcmp ((char *)curNode->name, "pointDaemon") == 0)
 			{
-				int readIdent = -1, pointCount = 0, signalCount = 0, relayCount = 0;
+				int readIdent = -1, pointCount = 0, signalCount = 0, relayCount = 0, maxMoving = SERVO_MOVING;
 
 				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"ident")) != NULL)
 				{
@@ -291,9 +331,15 @@ void parseTree(pointCtrlDef *pointCtrl, xmlNode *inNode, int level)
 					strncpy (clientName, (char *)tempStr, 40);
 					xmlFree (tempStr);
 				}
+				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"moving")) != NULL)
+				{
+					sscanf ((char *)tempStr, "%d", &maxMoving);
+					xmlFree (tempStr);
+				}
 				if (readIdent == pointCtrl -> clientID)
 				{
 					strncpy (pointCtrl -> clientName, clientName, 41);
+					pointCtrl -> maxMoving = maxMoving;
 					processPoints (pointCtrl, curNode -> children, pointCount, signalCount, relayCount);
 				}
 			}
@@ -337,6 +383,30 @@ int parseMemoryXML (pointCtrlDef *pointCtrl, char *buffer)
 	return retn;
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  S T A T E                                                                                                *
+ *  ==================                                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send a point, signal or relay state to the daemon, as a binary frame if it has agreed to them.
+ *  \param pointCtrl Current point states.
+ *  \param handle Socket handle to send to.
+ *  \param opcode y for a point, x for a signal or w for a relay.
+ *  \param server Identity of this server.
+ *  \param ident Identity of the point, signal or relay.
+ *  \param state State to send.
+ *  \result None.
+ */
+static void sendState (pointCtrlDef *pointCtrl, int handle, char opcode, int server, int ident, int state)
+{
+	char tempBuff[DCC_FORMAT_SIZE];
+	int values[3] = { server, ident, state };
+
+	SendSocket (handle, tempBuff, dccFormat (tempBuff, pointCtrl -> frameVersion, opcode, 3, values));
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  U P D A T E  P O I N T                                                                                            *
@@ -361,17 +431,11 @@ void updatePoint (pointCtrlDef *pointCtrl, int handle, int server, int point, in
 		{
 			if (pointCtrl -> pointStates[i].ident == point)
 			{
-				char tempBuff[81];
-
-				pthread_mutex_lock (&priorityMutex);
 				servoMove (&pointCtrl -> pointStates[i].servoState, state ?
 						pointCtrl -> pointStates[i].turnoutPos :
-						pointCtrl -> pointStates[i].defaultPos,
-						++curPriority);
-				pthread_mutex_unlock (&priorityMutex);
+						pointCtrl -> pointStates[i].defaultPos);
 				pointCtrl -> pointStates[i].state = state;
-				sprintf (tempBuff, "<y %d %d %d>", server, point, state);
-				SendSocket (handle, tempBuff, strlen (tempBuff));
+				sendState (pointCtrl, handle, 'y', server, point, state);
 				break;
 			}
 		}
@@ -402,8 +466,6 @@ void updateSignal (pointCtrlDef *pointCtrl, int handle, int server, int signal,
 		{
 			if (pointCtrl -> signalStates[i].ident == signal)
 			{
-				char tempBuff[81];
-
 				if (pointCtrl -> signalStates[i].type == 0)
 				{
 #ifdef HAVE_WIRINGPI_H
@@ -430,17 +492,12 @@ void updateSignal (pointCtrlDef *pointCtrl, int handle, int server, int signal,
 				}
 				else if (pointCtrl -> signalStates[i].type == 1)
 				{
-
-					pthread_mutex_lock (&priorityMutex);
 					servoMove (&pointCtrl -> signalStates[i].servoState, state == 0 ? 0 : state == 1 ?
 							pointCtrl -> signalStates[i].redOut :
-							pointCtrl -> signalStates[i].greenOut,
-							++curPriority);
-					pthread_mutex_unlock (&priorityMutex);
+							pointCtrl -> signalStates[i].greenOut);
 				}
 				pointCtrl -> signalStates[i].state = state;
-				sprintf (tempBuff, "<x %d %d %d>", server, signal, state);
-				SendSocket (handle, tempBuff, strlen (tempBuff));
+				sendState (pointCtrl, handle, 'x', server, signal, state);
 				break;
 			}
 		}
@@ -471,14 +528,11 @@ void updateRelay (pointCtrlDef *pointCtrl, int handle, int server, int relay, in
 		{
 			if (pointCtrl -> relayStates[i].ident == relay)
 			{
-				char tempBuff[81];
-
 				pointCtrl -> relayStates[i].state = state;
 #ifdef HAVE_WIRINGPI_H
 				digitalWrite (pointCtrl -> relayStates[i].pinOut, state ? HIGH : LOW);
 #endif
-				sprintf (tempBuff, "<w %d %d %d>", server, relay, state);
-				SendSocket (handle, tempBuff, strlen (tempBuff));
+				sendState (pointCtrl, handle, 'w', server, relay, state);
 				break;
 			}
 		}
@@ -500,14 +554,11 @@ void updateRelay (pointCtrlDef *pointCtrl, int handle, int server, int relay, in
 void updateAllPoints (pointCtrlDef *pointCtrl, int handle)
 {
 	int i;
-	char tempBuff[81];
 
 	for (i = 0; i < pointCtrl -> pointCount; ++i)
 	{
-		sprintf (tempBuff, "<y %d %d %d>", pointCtrl -> clientID,
-				pointCtrl -> pointStates[i].ident,
+		sendState (pointCtrl, handle, 'y', pointCtrl -> clientID, pointCtrl -> pointStates[i].ident,
 				pointCtrl -> pointStates[i].state);
-		SendSocket (handle, tempBuff, strlen (tempBuff));
 	}
 }
 
@@ -526,14 +577,11 @@ void updateAllPoints (pointCtrlDef *pointCtrl, int handle)
 void updateAllSignals (pointCtrlDef *pointCtrl, int handle)
 {
 	int i;
-	char tempBuff[81];
 
 	for (i = 0; i < pointCtrl -> signalCount; ++i)
 	{
-		sprintf (tempBuff, "<x %d %d %d>", pointCtrl -> clientID,
-				pointCtrl -> signalStates[i].ident,
+		sendState (pointCtrl, handle, 'x', pointCtrl -> clientID, pointCtrl -> signalStates[i].ident,
 				pointCtrl -> signalStates[i].state);
-		SendSocket (handle, tempBuff, strlen (tempBuff));
 	}
 }
 
@@ -552,17 +600,114 @@ void updateAllSignals (pointCtrlDef *pointCtrl, int handle)
 void updateAllRelays (pointCtrlDef *pointCtrl, int handle)
 {
 	int i;
-	char tempBuff[81];
 
 	for (i = 0; i < pointCtrl -> relayCount; ++i)
 	{
-		sprintf (tempBuff, "<w %d %d %d>", pointCtrl -> clientID,
-				pointCtrl -> relayStates[i].ident,
+		sendState (pointCtrl, handle, 'w', pointCtrl -> clientID, pointCtrl -> relayStates[i].ident,
 				pointCtrl -> relayStates[i].state);
-		SendSocket (handle, tempBuff, strlen (tempBuff));
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  P O I N T  C O M M A N D                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Point control, move one point or report them all.
+ *  \param message Message that was received.
+ *  \param handle Socket handle.
+ *  \param userData Current point states.
+ *  \result None.
+ */
+void pointCommand (dccMessageDef *message, int handle, void *userData)
+{
+	pointCtrlDef *pointCtrl = (pointCtrlDef *)userData;
+
+	if (message -> wordCount == 4)
+		updatePoint (pointCtrl, handle, dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3));
+	else
+		updateAllPoints (pointCtrl, handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S I G N A L  C O M M A N D                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Signal control, change one signal or report them all.
+ *  \param message Message that was received.
+ *  \param handle Socket handle.
+ *  \param userData Current point states.
+ *  \result None.
+ */
+void signalCommand (dccMessageDef *message, int handle, void *userData)
+{
+	pointCtrlDef *pointCtrl = (pointCtrlDef *)userData;
+
+	if (message -> wordCount == 4)
+		updateSignal (pointCtrl, handle, dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3));
+	else
+		updateAllSignals (pointCtrl, handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  R E L A Y  C O M M A N D                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Relay control, change one relay or report them all.
+ *  \param message Message that was received.
+ *  \param handle Socket handle.
+ *  \param userData Current point states.
+ *  \result None.
+ */
+void relayCommand (dccMessageDef *message, int handle, void *userData)
+{
+	pointCtrlDef *pointCtrl = (pointCtrlDef *)userData;
+
+	if (message -> wordCount == 4)
+		updateRelay (pointCtrl, handle, dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3));
+	else
+		updateAllRelays (pointCtrl, handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F R A M E S  C O M M A N D                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief The daemon has agreed to binary frames, use them for replies from now on.
+ *  \param message Message that was received.
+ *  \param handle Socket handle.
+ *  \param userData Current point states.
+ *  \result None.
+ */
+void framesCommand (dccMessageDef *message, int handle, void *userData)
+{
+	pointCtrlDef *pointCtrl = (pointCtrlDef *)userData;
+	int version = dccWordInt (message, 1);
+
+	pointCtrl -> frameVersion = version > DCC_FRAME_VERSION ? DCC_FRAME_VERSION : version;
+}
+
+dccCommandDef pointCommands[] =
+{
+	{	'Y',	0,	-1,	pointCommand	},
+	{	'X',	0,	-1,	signalCommand	},
+	{	'W',	0,	-1,	relayCommand	},
+	{	'K',	2,	2,	framesCommand	},
+	{	0,		0,	-1,	NULL			}
+};
+dccDispatchDef pointDispatch;
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  C H E C K  R E C V  B U F F E R                                                                                   *
@@ -579,114 +724,10 @@ void updateAllRelays (pointCtrlDef *pointCtrl, int handle)
  */
 void checkRecvBuffer (pointCtrlDef *pointCtrl, int handle, char *buffer, int len)
 {
-	char words[41][41];
-	int wordNum = -1, i = 0, j = 0, inType = 0;
-
 /*------------------------------------------------------------------*
 	printf ("Rxed:[%s]\n", buffer);
  *------------------------------------------------------------------*/
-	while (i < len)
-	{
-		if (buffer[i] == '<' && wordNum == -1)
-		{
-			words[wordNum = 0][0] = 0;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= 'a' && buffer[i] <= 'z') || (buffer[i] >= 'A' && buffer[i] <= 'Z')))
-		{
-			if (inType == 2 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 1;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= '0' && buffer[i] <= '9') || buffer[i] == '-' || buffer[i] == '.'))
-		{
-			if (inType == 1 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 2;
-		}
-		else if (wordNum >= 0 && buffer[i] == '>')
-		{
-			if (j)
-				words[++wordNum][0] = 0;
-
-/*------------------------------------------------------------------*
-			for (l = 0; l < wordNum; ++l)
-			{
-				printf ("[%s]", words[l]);
-			}
-			printf ("(%d)\n", wordNum);
- *------------------------------------------------------------------*/
-			/* Point control */
-			if (words[0][0] == 'Y' && words[0][1] == 0)
-			{
-				if (wordNum == 4)
-				{
-					int server = atoi (words[1]);
-					int point = atoi (words[2]);
-					int state = atoi (words[3]);
-					updatePoint (pointCtrl, handle, server, point, state);
-				}
-				else
-				{
-					updateAllPoints (pointCtrl, handle);
-				}
-			}
-			else if (words[0][0] == 'X' && words[0][1] == 0)
-			{
-				if (wordNum == 4)
-				{
-					int server = atoi (words[1]);
-					int signal = atoi (words[2]);
-					int state = atoi (words[3]);
-					updateSignal (pointCtrl, handle, server, signal, state);
-				}
-				else
-				{
-					updateAllSignals (pointCtrl, handle);
-				}
-			}
-			else if (words[0][0] == 'W' && words[0][1] == 0)
-			{
-				if (wordNum == 4)
-				{
-					int server = atoi (words[1]);
-					int relay = atoi (words[2]);
-					int state = atoi (words[3]);
-					updateRelay (pointCtrl, handle, server, relay, state);
-				}
-				else
-				{
-					updateAllRelays (pointCtrl, handle);
-				}
-			}
-			inType = 0;
-			wordNum = -1;
-			j = 0;
-		}
-		else if (wordNum >= 0 && j > 0 && (buffer[i] == ' ' || buffer[i] == '|'))
-		{
-			words[++wordNum][0] = 0;
-			j = 0;
-		}
-		if (wordNum > 40)
-		{
-			words[wordNum = 40][0] = 0;
-			j = 0;
-		}
-		if (j > 40)
-			j = 40;
-
-		++i;
-	}
+	dccParseStream (&pointCtrl -> rxedStream, &pointDispatch, buffer, len, handle, pointCtrl);
 }
 
 /**********************************************************************************************************************
@@ -696,59 +737,57 @@ void checkRecvBuffer (pointCtrlDef *pointCtrl, int handle, char *buffer, int len
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Turn off the point after it moves.
+ *  \brief Move all the servos that have work to do each tick, oldest request first. Only maxMoving may be
+ *  travelling at once to limit the current drawn, the rest wait their turn. Everything that changed in the tick
+ *  is written in one batch at the end, then the servo is turned off after it moves. When there is nothing queued
+ *  the thread sleeps until servoMove queues something.
  *  \param pointPtr Point configuration pointer.
  *  \result None.
  */
 void *checkPointsState (void *pointPtr)
 {
 	pointCtrlDef *pointCtrl = (pointCtrlDef *)pointPtr;
+	int *working = NULL;
+	servoStateDef **active = NULL;
+	servoBatchDef batch;
+
+	if (servoQueue.size == 0)
+		return NULL;
+
+	active = (servoStateDef **)malloc (servoQueue.size * sizeof (servoStateDef *));
+	working = (int *)malloc (servoQueue.size * sizeof (int));
+	if (active == NULL || working == NULL)
+	{
+		putLogMessage (LOG_ERR, "Out of memory for servo list");
+		if (active != NULL)
+			free (active);
+		if (working != NULL)
+			free (working);
+		return NULL;
+	}
+	batch.count = 0;
 
 	while (running)
 	{
-		int i, selServo = -1, selServoPrio = -1, selType = -1;
+		int i, moving = 0, activeCount = servoQueueTake (&servoQueue, active);
 
-		for (i = 0; i < pointCtrl -> pointCount; ++i)
+		for (i = 0; i < activeCount; ++i)
 		{
-			int curPrio = pointCtrl -> pointStates[i].servoState.priority;
-			if (curPrio > 0)
+			working[i] = 1;
+			if (servoMoving (active[i]))
 			{
-				if (selServo == -1 || curPrio < selServoPrio)
-				{
-					selType = 0;
-					selServo = i;
-					selServoPrio = curPrio;
-				}
+				if (pointCtrl -> maxMoving > 0 && moving >= pointCtrl -> maxMoving)
+					continue;
+				++moving;
 			}
+			working[i] = servoUpdate (active[i], &batch);
 		}
-		for (i = 0; i < pointCtrl -> signalCount; ++i)
-		{
-			int curPrio = pointCtrl -> signalStates[i].servoState.priority;
-			if (curPrio > 0)
-			{
-				if (selServo == -1 || curPrio < selServoPrio)
-				{
-					selType = 1;
-					selServo = i;
-					selServoPrio = curPrio;
-				}
-			}
-		}
-		if (selType != -1)
-		{
-			if (selType == 0)
-				servoUpdate (&pointCtrl -> pointStates[selServo].servoState);
-			else
-				servoUpdate (&pointCtrl -> signalStates[selServo].servoState);
-		}
-		else
-		{
-			pthread_mutex_lock (&priorityMutex);
-			curPriority = 0;
-			pthread_mutex_unlock (&priorityMutex);
-		}
+		servoBatchFlush (&batch);
+		servoQueueReturn (&servoQueue, active, working, activeCount);
 		usleep (50000);
 	}
+	free (active);
+	free (working);
 	return NULL;
 }
 
@@ -767,6 +806,12 @@ int pointControlSetup (pointCtrlDef *pointCtrl)
 {
 	int i, piSetup = 0;
 
+	dccDispatchInit (&pointDispatch, pointCommands);
+	if (!servoQueueInit (&servoQueue, pointCtrl -> pointCount + pointCtrl -> signalCount))
+	{
+		putLogMessage (LOG_ERR, "Out of memory for servo queue");
+		return 0;
+	}
 	if (pointCtrl -> pointCount || pointCtrl -> signalCount)
 	{
 #ifdef HAVE_WIRINGPI_H
@@ -783,7 +828,7 @@ int pointControlSetup (pointCtrlDef *pointCtrl)
 		for (i = 0; i < pointCtrl -> pointCount; ++i)
 		{
 			servoInit (&pointCtrl -> pointStates[i].servoState, pointCtrl -> pointStates[i].servoChannel,
-					pointCtrl -> pointStates[i].defaultPos);
+					pointCtrl -> pointStates[i].defaultPos, &pointCtrl -> pointStates[i].profile, &servoQueue);
 		}
 		for (i = 0; i < pointCtrl -> signalCount; ++i)
 		{
@@ -799,7 +844,7 @@ int pointControlSetup (pointCtrlDef *pointCtrl)
 			else if (pointCtrl -> signalStates[i].type == 1)
 			{
 				servoInit (&pointCtrl -> signalStates[i].servoState, pointCtrl -> signalStates[i].servoChannel,
-						pointCtrl -> signalStates[i].redOut);
+						pointCtrl -> signalStates[i].redOut, &pointCtrl -> signalStates[i].profile, &servoQueue);
 			}
 			pointCtrl -> signalStates[i].state = 1;
 		}
@@ -817,7 +862,6 @@ int pointControlSetup (pointCtrlDef *pointCtrl)
 #endif
 	}
 
-	pthread_mutex_init (&priorityMutex, NULL);
 	if (pthread_create (&threadHandle, NULL, checkPointsState, pointCtrl) != 0)
 	{
 		return 0;
@@ -28,6 +28,7 @@ typedef struct _pointState
 	int defaultPos;
 	int turnoutPos;
 	int servoChannel;
+	servoProfileDef profile;
 	servoStateDef servoState;
 }
 pointStateDef;
@@ -42,6 +43,7 @@ typedef struct _signalState
 	int redOut;
 	int greenOut;
 	int servoChannel;
+	servoProfileDef profile;
 	servoStateDef servoState;
 }
 signalStateDef;
@@ -63,11 +65,14 @@ typedef struct _pointCtrl
 	int pointCount;
 	int signalCount;
 	int relayCount;
+	int maxMoving;
+	int frameVersion;
 	char clientName[41];
 	char serverName[81];
 	pointStateDef *pointStates;
 	signalStateDef *signalStates;
 	relayStateDef *relayStates;
+	dccStreamDef rxedStream;
 }
 pointCtrlDef;
 
@@ -38,6 +38,7 @@
 #include "config.h"
 #include "socketC.h"
 #include "servoCtrl.h"
+#include "dccParse.h"
 #include "pointControl.h"
 #include "buildDate.h"
 
@@ -311,6 +312,7 @@ int main (int argc, char *argv[])
 
 	pointCtrl.ipVersion = USE_ANY;
 	pointCtrl.conTimeout = 5;
+	dccStreamInit (&pointCtrl.rxedStream, 1024);
 	loadConfigFile ();
 	if (!pointCtrl.clientID)
 	{
@@ -347,8 +349,9 @@ int main (int argc, char *argv[])
 				if (serverHandle != -1)
 				{
 					char tempBuff[81];
-					sprintf (tempBuff, "<P %d %s>", pointCtrl.clientID, pointCtrl.clientName);
+					sprintf (tempBuff, "<P %d %s><K %d>", pointCtrl.clientID, pointCtrl.clientName, DCC_FRAME_VERSION);
 					SendSocket (serverHandle, tempBuff, strlen (tempBuff));
+					pointCtrl.frameVersion = 0;
 					lastCheck = time (NULL);
 					holdOffConnect = lastCheck + 15;
 					continue;
@@ -389,6 +392,7 @@ int main (int argc, char *argv[])
 					{
 						putLogMessage (LOG_INFO, "P:Socket closed(%d)", serverHandle);
 						CloseSocket (&serverHandle);
+						dccStreamFree (&pointCtrl.rxedStream);
 						holdOffConnect = time(NULL) + 15;
 					}
 				}
@@ -22,7 +22,9 @@
  *  \brief Fuction to control the servos an slow the update.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <syslog.h>
+#include <time.h>
 #include "config.h"
 
 #ifdef HAVE_WIRINGPI_H
@@ -31,8 +33,29 @@
 #endif
 
 #include "servoCtrl.h"
+#include "dccParse.h"
 #include "pointControl.h"
 
+extern int servoFD;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  M S  T I M E                                                                                           *
+ *  =======================                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get a millisecond clock that is not changed when the time of day is set.
+ *  \result Milliseconds.
+ */
+static long long servoMsTime ()
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  S E R V O  I N I T                                                                                                *
@@ -44,15 +67,34 @@
  *  \param servoDef Default servo poition.
  *  \param channel Servo channel number.
  *  \param defPos Default servo poition.
+ *  \param profile How the servo moves, NULL for the default.
+ *  \param queue Queue the servo joins when it has work to do.
  *  \result None.
  */
-void servoInit (servoStateDef *servoDef, int channel, int defPos)
+void servoInit (servoStateDef *servoDef, int channel, int defPos, servoProfileDef *profile, servoQueueDef *queue)
 {
 	servoDef -> state = SERVO_CHECK;
 	servoDef -> channel = channel;
 	servoDef -> currentPos = defPos;
 	servoDef -> targetPos = defPos;
 	servoDef -> count = 0;
+	servoDef -> startPos = defPos;
+	servoDef -> moveTime = 0;
+	servoDef -> startTime = 0;
+	if (profile != NULL)
+	{
+		servoDef -> profile = *profile;
+	}
+	else
+	{
+		servoDef -> profile.duration = 0;
+		servoDef -> profile.profile = SERVO_LINEAR;
+		servoDef -> profile.overshoot = 0;
+	}
+	servoDef -> priority = 0;
+	servoDef -> heapIndex = SERVO_IDLE;
+	servoDef -> requeue = 0;
+	servoDef -> queue = queue;
 
 	pthread_mutex_init (&servoDef -> updateMutex, NULL);
 }
@@ -80,12 +122,12 @@ void servoFree (servoStateDef *servoDef)
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Move the servo to a new position.
+ *  \brief Move the servo to a new position, then queue it for the servo thread.
  *  \param servoDef Servo configuration.
  *  \param newPos New servo position.
  *  \result None.
  */
-void servoMove (servoStateDef *servoDef, int newPos, int priority)
+void servoMove (servoStateDef *servoDef, int newPos)
 {
 	pthread_mutex_lock (&servoDef -> updateMutex);
 	if (newPos == 0)
@@ -93,22 +135,83 @@ void servoMove (servoStateDef *servoDef, int newPos, int priority)
 		servoDef -> currentPos = servoDef -> targetPos;
 		servoDef -> state = SERVO_SLEEP;
 		servoDef -> count = SERVO_WAIT;
-		servoDef -> priority = priority;
 	}
 	else if (newPos == servoDef -> currentPos)
 	{
 		servoDef -> state = SERVO_CHECK;
 		servoDef -> count = 0;
-		servoDef -> priority = priority;
 	}
 	else
 	{
 		servoDef -> state = SERVO_MOVE;
 		servoDef -> targetPos = newPos;
+		servoDef -> startTime = 0;
 		servoDef -> count = 0;
-		servoDef -> priority = priority;
 	}
 	pthread_mutex_unlock (&servoDef -> updateMutex);
+
+	if (servoDef -> queue != NULL)
+		servoQueuePut (servoDef -> queue, servoDef);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  M O V I N G                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check if the servo is on its way to a new position, these are the ones that draw the most current.
+ *  \param servoDef Servo configuration.
+ *  \result 1 if it is moving.
+ */
+int servoMoving (servoStateDef *servoDef)
+{
+	int moving;
+
+	pthread_mutex_lock (&servoDef -> updateMutex);
+	moving = (servoDef -> state == SERVO_MOVE);
+	pthread_mutex_unlock (&servoDef -> updateMutex);
+	return moving;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  P O S I T I O N                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Work out where a moving servo should be from the time since it started. The move takes the same time
+ *  however busy the servo thread is, an overshoot goes past the target then settles back.
+ *  \param servoDef Servo configuration.
+ *  \param elapsed Milliseconds since the move started.
+ *  \param done Set to 1 when the move is finished.
+ *  \result Servo position.
+ */
+static int servoPosition (servoStateDef *servoDef, long long elapsed, int *done)
+{
+	int endPos = servoDef -> targetPos;
+
+	if (servoDef -> profile.overshoot)
+		endPos += (endPos > servoDef -> startPos ? servoDef -> profile.overshoot : -servoDef -> profile.overshoot);
+
+	*done = 0;
+	if (elapsed < servoDef -> moveTime)
+	{
+		double part = (double)elapsed / servoDef -> moveTime;
+
+		if (servoDef -> profile.profile == SERVO_EASE)
+			part = part * part * (3.0 - (2.0 * part));
+
+		return servoDef -> startPos + (int)((endPos - servoDef -> startPos) * part);
+	}
+	elapsed -= servoDef -> moveTime;
+	if (servoDef -> profile.overshoot && elapsed < SERVO_SETTLE)
+		return endPos + (int)((servoDef -> targetPos - endPos) * elapsed / SERVO_SETTLE);
+
+	*done = 1;
+	return servoDef -> targetPos;
 }
 
 /**********************************************************************************************************************
@@ -118,48 +221,42 @@ void servoMove (servoStateDef *servoDef, int newPos, int priority)
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Called from a thread to update the servo.
+ *  \brief Called from a thread to update the servo, any new output is added to the batch for this tick.
  *  \param servoDef Servo configuration.
- *  \result None.
+ *  \param batch Outputs to write at the end of the tick.
+ *  \result 1 if the servo still has work to do.
  */
-int servoUpdate (servoStateDef *servoDef)
+int servoUpdate (servoStateDef *servoDef, servoBatchDef *batch)
 {
-	int update = 0;
+	int update = 1, done = 0;
+	long long now;
+
 	pthread_mutex_lock (&servoDef -> updateMutex);
 	switch (servoDef -> state)
 	{
 	case SERVO_CHECK:
-#ifdef HAVE_WIRINGPI_H
-		pwmWrite(PIN_BASE + servoDef -> channel, servoDef -> currentPos);
-		update = 1;
-#endif
+		servoBatchAdd (batch, servoDef -> channel, servoDef -> currentPos);
 		servoDef -> state = SERVO_SLEEP;
 		servoDef -> count = SERVO_WAIT;
 		break;
 
 	case SERVO_MOVE:
-		if (servoDef -> currentPos == servoDef -> targetPos)
-		{
-			servoDef -> state = SERVO_SLEEP;
-			servoDef -> count = SERVO_WAIT;
-			break;
-		}
-		else if (servoDef -> currentPos < servoDef -> targetPos)
+		now = servoMsTime ();
+		if (servoDef -> startTime == 0)
 		{
-			servoDef -> currentPos += SERVO_STEP;
-			if (servoDef -> currentPos > servoDef -> targetPos)
-				servoDef -> currentPos = servoDef -> targetPos;
+			servoDef -> startTime = now;
+			servoDef -> startPos = servoDef -> currentPos;
+			servoDef -> moveTime = servoDef -> profile.duration;
+			if (servoDef -> moveTime <= 0)
+				servoDef -> moveTime = abs (servoDef -> targetPos - servoDef -> startPos) * SERVO_TICK / SERVO_STEP;
 		}
-		else if (servoDef -> currentPos > servoDef -> targetPos)
+		servoDef -> currentPos = servoPosition (servoDef, now - servoDef -> startTime, &done);
+		servoBatchAdd (batch, servoDef -> channel, servoDef -> currentPos);
+		if (done)
 		{
-			servoDef -> currentPos -= SERVO_STEP;
-			if (servoDef -> currentPos < servoDef -> targetPos)
-				servoDef -> currentPos = servoDef -> targetPos;
+			servoDef -> state = SERVO_SLEEP;
+			servoDef -> count = SERVO_WAIT;
 		}
-#ifdef HAVE_WIRINGPI_H
-		pwmWrite(PIN_BASE + servoDef -> channel, servoDef -> currentPos);
-		update = 1;
-#endif
 		break;
 
 	case SERVO_SLEEP:
@@ -169,16 +266,339 @@ int servoUpdate (servoStateDef *servoDef)
 		}
 		else if (servoDef -> count == 0)
 		{
-#ifdef HAVE_WIRINGPI_H
-			pwmWrite(PIN_BASE + servoDef -> channel, 0);
-#endif
+			servoBatchAdd (batch, servoDef -> channel, 0);
 			servoDef -> state = SERVO_OFF;
-			servoDef -> priority = 0;
+			update = 0;
 		}
-		update = 1;
+		break;
+
+	default:
+		update = 0;
 		break;
 	}
 	pthread_mutex_unlock (&servoDef -> updateMutex);
 	return update;
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  B A T C H  A D D                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add an output to the batch for this tick, kept in channel order. A channel already in the batch just
+ *  has its value changed.
+ *  \param batch Batch to add to.
+ *  \param channel Servo channel number.
+ *  \param value Value to write.
+ *  \result None.
+ */
+void servoBatchAdd (servoBatchDef *batch, int channel, int value)
+{
+	int i, j;
+
+	for (i = 0; i < batch -> count && batch -> channel[i] < channel; ++i)
+		;
+	if (i < batch -> count && batch -> channel[i] == channel)
+	{
+		batch -> value[i] = value;
+		return;
+	}
+	if (batch -> count == SERVO_CHANNELS)
+		return;
+
+	for (j = batch -> count; j > i; --j)
+	{
+		batch -> channel[j] = batch -> channel[j - 1];
+		batch -> value[j] = batch -> value[j - 1];
+	}
+	batch -> channel[i] = channel;
+	batch -> value[i] = value;
+	++batch -> count;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  B A T C H  F L U S H                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Write all the outputs collected this tick, then empty the batch. Each run of channels next to each
+ *  other is written in one I2C transaction.
+ *  \param batch Batch to write.
+ *  \result None.
+ */
+void servoBatchFlush (servoBatchDef *batch)
+{
+#ifdef HAVE_WIRINGPI_H
+	int i, first = 0;
+
+	for (i = 1; i <= batch -> count; ++i)
+	{
+		if (i == batch -> count || batch -> channel[i] != batch -> channel[i - 1] + 1)
+		{
+			pca9685PWMValues (servoFD, batch -> channel[first], i - first, &batch -> value[first]);
+			first = i;
+		}
+	}
+#endif
+	batch -> count = 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  H E A P  S W A P                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Swap two entries in the queue heap, keeping the index in each servo up to date.
+ *  \param queue Servo queue.
+ *  \param a First index.
+ *  \param b Second index.
+ *  \result None.
+ */
+static void servoHeapSwap (servoQueueDef *queue, int a, int b)
+{
+	servoStateDef *temp = queue -> heap[a];
+
+	queue -> heap[a] = queue -> heap[b];
+	queue -> heap[b] = temp;
+	queue -> heap[a] -> heapIndex = a;
+	queue -> heap[b] -> heapIndex = b;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  H E A P  U P                                                                                           *
+ *  =======================                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Move an entry up the heap until its parent was requested before it.
+ *  \param queue Servo queue.
+ *  \param index Index of the entry to move.
+ *  \result None.
+ */
+static void servoHeapUp (servoQueueDef *queue, int index)
+{
+	while (index > 0)
+	{
+		int parent = (index - 1) / 2;
+
+		if (queue -> heap[parent] -> priority <= queue -> heap[index] -> priority)
+			break;
+
+		servoHeapSwap (queue, parent, index);
+		index = parent;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  H E A P  D O W N                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Move an entry down the heap until both its children were requested after it.
+ *  \param queue Servo queue.
+ *  \param index Index of the entry to move.
+ *  \result None.
+ */
+static void servoHeapDown (servoQueueDef *queue, int index)
+{
+	while (1)
+	{
+		int child = (index * 2) + 1;
+
+		if (child >= queue -> count)
+			break;
+		if (child + 1 < queue -> count && queue -> heap[child + 1] -> priority < queue -> heap[child] -> priority)
+			++child;
+		if (queue -> heap[index] -> priority <= queue -> heap[child] -> priority)
+			break;
+
+		servoHeapSwap (queue, index, child);
+		index = child;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  H E A P  P U S H                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add a servo to the heap, the queue lock must be held.
+ *  \param queue Servo queue.
+ *  \param servoDef Servo to add.
+ *  \result None.
+ */
+static void servoHeapPush (servoQueueDef *queue, servoStateDef *servoDef)
+{
+	if (queue -> count == queue -> size)
+	{
+		servoDef -> heapIndex = SERVO_IDLE;
+		return;
+	}
+	servoDef -> heapIndex = queue -> count;
+	queue -> heap[queue -> count++] = servoDef;
+	servoHeapUp (queue, servoDef -> heapIndex);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  Q U E U E  I N I T                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Set up the queue of servos that have work to do.
+ *  \param queue Servo queue.
+ *  \param size Most servos that can be queued.
+ *  \result 1 if all went OK.
+ */
+int servoQueueInit (servoQueueDef *queue, int size)
+{
+	queue -> count = queue -> sequence = 0;
+	queue -> size = size;
+	queue -> heap = NULL;
+	if (size > 0 && (queue -> heap = (servoStateDef **)malloc (size * sizeof (servoStateDef *))) == NULL)
+		return 0;
+
+	pthread_mutex_init (&queue -> queueMutex, NULL);
+	pthread_cond_init (&queue -> queueCond, NULL);
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  Q U E U E  F R E E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Release the servo queue.
+ *  \param queue Servo queue.
+ *  \result None.
+ */
+void servoQueueFree (servoQueueDef *queue)
+{
+	if (queue -> heap != NULL)
+	{
+		free (queue -> heap);
+		queue -> heap = NULL;
+	}
+	pthread_cond_destroy (&queue -> queueCond);
+	pthread_mutex_destroy (&queue -> queueMutex);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  Q U E U E  P U T                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Queue a servo after the last request, a servo already queued moves to the back. If the servo thread is
+ *  working on it just now it is marked to go back in the queue when the thread is done.
+ *  \param queue Servo queue.
+ *  \param servoDef Servo to queue.
+ *  \result None.
+ */
+void servoQueuePut (servoQueueDef *queue, servoStateDef *servoDef)
+{
+	pthread_mutex_lock (&queue -> queueMutex);
+	servoDef -> priority = ++queue -> sequence;
+	if (servoDef -> heapIndex == SERVO_TAKEN)
+	{
+		servoDef -> requeue = 1;
+	}
+	else if (servoDef -> heapIndex >= 0)
+	{
+		servoHeapDown (queue, servoDef -> heapIndex);
+	}
+	else
+	{
+		servoHeapPush (queue, servoDef);
+		pthread_cond_signal (&queue -> queueCond);
+	}
+	pthread_mutex_unlock (&queue -> queueMutex);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  Q U E U E  T A K E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Wait until there are servos with work to do, then take them all from the queue oldest request first.
+ *  \param queue Servo queue.
+ *  \param active Filled with the servos taken, must hold the queue size.
+ *  \result Number of servos taken.
+ */
+int servoQueueTake (servoQueueDef *queue, servoStateDef **active)
+{
+	int activeCount = 0;
+
+	pthread_mutex_lock (&queue -> queueMutex);
+	while (queue -> count == 0)
+		pthread_cond_wait (&queue -> queueCond, &queue -> queueMutex);
+
+	while (queue -> count > 0)
+	{
+		active[activeCount] = queue -> heap[0];
+		active[activeCount++] -> heapIndex = SERVO_TAKEN;
+		if (--queue -> count > 0)
+		{
+			queue -> heap[0] = queue -> heap[queue -> count];
+			queue -> heap[0] -> heapIndex = 0;
+			servoHeapDown (queue, 0);
+		}
+	}
+	pthread_mutex_unlock (&queue -> queueMutex);
+	return activeCount;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R V O  Q U E U E  R E T U R N                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Put back the servos that still have work to do, or were moved again while the thread had them. When the
+ *  queue ends up empty the request count starts again.
+ *  \param queue Servo queue.
+ *  \param active Servos taken from the queue.
+ *  \param working Set for each servo that still has work to do.
+ *  \param activeCount Number of servos taken.
+ *  \result None.
+ */
+void servoQueueReturn (servoQueueDef *queue, servoStateDef **active, int *working, int activeCount)
+{
+	int i;
+
+	pthread_mutex_lock (&queue -> queueMutex);
+	for (i = 0; i < activeCount; ++i)
+	{
+		if (working[i] || active[i] -> requeue)
+		{
+			servoHeapPush (queue, active[i]);
+		}
+		else
+		{
+			active[i] -> heapIndex = SERVO_IDLE;
+			active[i] -> priority = 0;
+		}
+		active[i] -> requeue = 0;
+	}
+	if (queue -> count == 0)
+		queue -> sequence = 0;
+	pthread_mutex_unlock (&queue -> queueMutex);
+}
@@ -30,12 +30,30 @@
 
 #define SERVO_STEP		5
 #define SERVO_WAIT		6
+#define SERVO_TICK		50
+#define SERVO_SETTLE	200
+#define SERVO_LINEAR	0
+#define SERVO_EASE		1
+#define SERVO_CHANNELS	16
+#define SERVO_MOVING	4
+#define SERVO_IDLE		-1
+#define SERVO_TAKEN		-2
 
 #define PIN_BASE		300
 #define MAX_PWM			4096
 #define HERTZ			50
 #define PWM_DELAY		100
 
+struct _servoQueue;
+
+typedef struct _servoProfile
+{
+	int duration;
+	int profile;
+	int overshoot;
+}
+servoProfileDef;
+
 typedef struct _servoState
 {
 	int state;
@@ -43,13 +61,47 @@ typedef struct _servoState
 	int currentPos;
 	int targetPos;
 	int count;
+	int startPos;
+	int moveTime;
+	long long startTime;
+	servoProfileDef profile;
 	int priority;
+	int heapIndex;
+	int requeue;
+	struct _servoQueue *queue;
 	pthread_mutex_t updateMutex;
 }
 servoStateDef;
 
-void servoInit (servoStateDef *servoDef, int channel, int defPos);
+typedef struct _servoQueue
+{
+	int count;
+	int size;
+	int sequence;
+	servoStateDef **heap;
+	pthread_mutex_t queueMutex;
+	pthread_cond_t queueCond;
+}
+servoQueueDef;
+
+typedef struct _servoBatch
+{
+	int count;
+	int channel[SERVO_CHANNELS];
+	int value[SERVO_CHANNELS];
+}
+servoBatchDef;
+
+void servoInit (servoStateDef *servoDef, int channel, int defPos, servoProfileDef *profile, servoQueueDef *queue);
 void servoFree (servoStateDef *servoDef);
-void servoMove (servoStateDef *servoDef, int newPos, int priority);
-int servoUpdate (servoStateDef *servoDef);
+void servoMove (servoStateDef *servoDef, int newPos);
+int servoMoving (servoStateDef *servoDef);
+int servoUpdate (servoStateDef *servoDef, servoBatchDef *batch);
+void servoBatchAdd (servoBatchDef *batch, int channel, int value);
+void servoBatchFlush (servoBatchDef *batch);
+int servoQueueInit (servoQueueDef *queue, int size);
+void servoQueueFree (servoQueueDef *queue);
+void servoQueuePut (servoQueueDef *queue, servoStateDef *servoDef);
+int servoQueueTake (servoQueueDef *queue, servoStateDef **active);
+void servoQueueReturn (servoQueueDef *queue, servoStateDef **active, int *working, int activeCount);
 
@@ -22,6 +22,7 @@
  *  \brief Socket connections.
  */
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -132,7 +133,6 @@ int ServerSocketAccept (int socket, char *address)
 {
 	struct timeval timeout;
 	fd_set fdset;
-	int clientSocket = -1;
 
 	timeout.tv_sec = 1;
 	timeout.tv_usec = 0;
@@ -147,8 +147,25 @@ int ServerSocketAccept (int socket, char *address)
 	{
 		return -1;
 	}
+	return AcceptSocket (socket, address);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A C C E P T  S O C K E T                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Accept a connection without waiting, used when the caller already knows the socket is ready.
+ *  \param socket Listening socket.
+ *  \param address Save remote address here.
+ *  \result Handle of new socket, or -1 if there was nothing to accept (check errno).
+ */
+int AcceptSocket (int socket, char *address)
+{
+	int clientSocket = accept (socket, NULL, NULL);
 
-	clientSocket = accept (socket, NULL, NULL);
 	if (clientSocket != -1)
 	{
 		struct sockaddr_in6 clientaddr;
@@ -367,6 +384,42 @@ void setNonBlocking (int socket, int set)
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E T  S O C K E T  N O  D E L A Y                                                                                *
+ *  ==================================                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Turn Nagle off so small messages go out as soon as they are sent.
+ *  \param socket Socket to change.
+ *  \param set Set or clear the no delay flag.
+ *  \result None.
+ */
+void SetSocketNoDelay (int socket, int set)
+{
+	if (socket != -1)
+		setsockopt (socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&set, sizeof (set));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E T  S O C K E T  C O R K                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Hold back partial frames while several sends are made, clearing it sends what is left.
+ *  \param socket Socket to change.
+ *  \param set Set or clear the cork.
+ *  \result None.
+ */
+void SetSocketCork (int socket, int set)
+{
+	if (socket != -1)
+		setsockopt (socket, IPPROTO_TCP, TCP_CORK, (const char *)&set, sizeof (set));
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  S E N D  S O C K E T                                                                                              *
@@ -455,6 +508,36 @@ int RecvSocket (int socket, char *buffer, int size)
 	return (retn > 0 ? retn : 0);
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  R E C V  S O C K E T  N B                                                                                         *
+ *  =========================                                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Receive data from the socket without waiting, telling a closed socket apart from an empty one.
+ *  \param socket Which socket to receive from.
+ *  \param buffer Buffer to save to.
+ *  \param size Max size of the receive buffer.
+ *  \result Bytes received, 0 if the socket closed or failed, -1 if there is nothing more to read.
+ */
+int RecvSocketNB (int socket, char *buffer, int size)
+{
+	int retn;
+
+	do
+	{
+		retn = recv (socket, buffer, size, MSG_DONTWAIT);
+	}
+	while (retn == -1 && errno == EINTR);
+
+	if (retn == -1)
+	{
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? -1 : 0;
+	}
+	return retn;
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  C L O S E  S O C K E T                                                                                            *
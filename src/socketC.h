@@ -31,15 +31,19 @@
 int ServerSocketSetup (int port);
 int ServerSocketFile (char *fileName);
 int ServerSocketAccept (int socket, char *address);
+int AcceptSocket (int socket, char *address);
 int ConnectSocketFile (char *fileName);
 int ConnectClientSocket (char *host, int port, int timeout, int useIPVer, char *address);
 int SendSocket (int socket, char *buffer, int size);
 int WaitRecvSocket (int socket, char *buffer, int size, int secs);
 int RecvSocket (int socket, char *buffer, int size);
+int RecvSocketNB (int socket, char *buffer, int size);
 int WaitSocket (int socket, int secs);
 int CloseSocket (int *socket);
 int SocketValid (int socket);
 void setNonBlocking(int socket, int set);
+void SetSocketNoDelay (int socket, int set);
+void SetSocketCork (int socket, int set);
 int GetAddressFromName (char *name, char *address, int useIPVer);
 
 #endif
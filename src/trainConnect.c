@@ -22,198 +22,424 @@
  *  \brief Thread to handle the connectio to the daemon.
  */
 #include <gtk/gtk.h>
+#include <glib-unix.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <time.h>
+#include <sys/eventfd.h>
 
 #include "trainControl.h"
 #include "socketC.h"
+#include "dccParse.h"
+
+#define CONNECT_RING_SIZE	1024
+#define CONNECT_RING_MASK	(CONNECT_RING_SIZE - 1)
+#define CONNECT_EV_POWER	1
+#define CONNECT_EV_THROTTLE	2
+#define CONNECT_EV_READCV	3
+#define CONNECT_EV_FUNCTION	4
+#define CONNECT_EV_CURRENT	5
+#define CONNECT_EV_SESSION	6
+#define CONNECT_EV_POINT	7
+#define CONNECT_EV_SIGNAL	8
+#define CONNECT_EV_RELAY	9
+#define CONNECT_EV_LINK		10
+#define CONNECT_EV_FUNCBITS	11
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  C H E C K  R E C V  B U F F E R                                                                                   *
+ *  C O N N E C T  E V E N T  W A K E                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Wake the main loop so it reads the events from the ring.
+ *  \param trackCtrl Which is the active track.
+ *  \result Result of the write, it fails if the count is already very large, which is OK.
+ */
+static int connectEventWake (trackCtrlDef *trackCtrl)
+{
+	uint64_t wake = 1;
+	return write (trackCtrl -> eventHandle, &wake, sizeof (wake));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  N E W                                                                                   *
  *  ===============================                                                                                   *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Chech what we have received on the socket to see if we should update the display.
+ *  \brief Get the next free event in the ring, only called by the connection thread. If the ring is full wake the
+ *  main loop and wait for it to make some space.
  *  \param trackCtrl Which is the active track.
- *  \param buffer Buffer that was received.
- *  \param len Length of the buffer.
- *  \result None.
+ *  \param type Type of event.
+ *  \result Pointer to the event to fill in, NULL if the thread is stopping.
  */
-void checkRecvBuffer (trackCtrlDef *trackCtrl, char *buffer, int len)
+static connectEventDef *connectEventNew (trackCtrlDef *trackCtrl, int type)
 {
-	char words[41][41];
-	int wordNum = -1, i = 0, j = 0, inType = 0;
-	int queueDraw = 0;
+	connectEventDef *event;
+	unsigned int head = trackCtrl -> eventHead;
 
-/*------------------------------------------------------------------*
-	printf ("Rxed:[%s]\n", buffer);
-*------------------------------------------------------------------*/
-	while (i < len)
+	while (head - __atomic_load_n (&trackCtrl -> eventTail, __ATOMIC_ACQUIRE) >= CONNECT_RING_SIZE)
 	{
-		if (buffer[i] == '<' && wordNum == -1)
-		{
-			words[wordNum = 0][0] = 0;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= 'a' && buffer[i] <= 'z') || (buffer[i] >= 'A' && buffer[i] <= 'Z')))
-		{
-			if (inType == 2 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 1;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= '0' && buffer[i] <= '9') || buffer[i] == '-' || buffer[i] == '.'))
-		{
-			if (inType == 1 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 2;
-		}
-		else if (wordNum >= 0 && buffer[i] == '>')
-		{
-			if (j)
-				words[++wordNum][0] = 0;
+		if (!trackCtrl -> connectRunning)
+			return NULL;
+		connectEventWake (trackCtrl);
+		usleep (1000);
+	}
+	event = &trackCtrl -> eventRing[head & CONNECT_RING_MASK];
+	event -> type = type;
+	event -> count = 0;
+	return event;
+}
 
-/*------------------------------------------------------------------*
-			int l = 0;
-			for (l = 0; l < wordNum; ++l)
-			{
-				printf ("[%s]", words[l]);
-			}
-			printf ("(%d)\n", wordNum);
-*------------------------------------------------------------------*/
-			/* Track power status */
-			if (words[0][0] == 'p' && words[0][1] == 0 && (wordNum == 2 || wordNum == 3))
-			{
-				int power = atoi(words[1]);
-				trackCtrl -> remotePowerState = power;
-				if (!power)
-					trackCtrl -> remoteCurrent = -1;
-			}
-			/* Throttle status */
-			else if (words[0][0] == 'T' && words[0][1] == 0 && wordNum == 4)
-			{
-				int trainReg = atoi(words[1]), t;
-				for (t = 0; t < trackCtrl -> trainCount; ++t)
-				{
-					if (trackCtrl -> trainCtrl[t].trainReg == trainReg)
-					{
-						trackCtrl -> trainCtrl[t].remoteCurSpeed = atoi(words[2]);
-						trackCtrl -> trainCtrl[t].remoteReverse = atoi(words[3]);
-					}
-				}
-			}
-			/* Read CV value */
-			else if (words[0][0] == 'r' && words[0][1] == 0 && wordNum == 5)
-			{
-				if (atoi (words[1]) == trackCtrl -> serverSession)
-				{
-					char binary[9];
-					int val = atoi (words[4]), mask = 0x80, i;
-					for (i = 0; i < 8; ++i)
-					{
-						binary[i] = (val & mask ? '1' : '0');
-						mask >>= 1;
-					}
-					binary[i] = 0;
-					snprintf (trackCtrl -> remoteProgMsg, 110, "Read CV#%s value: %s [%s]",
-								words[3], words[4], binary);
-				}
-			}
-			/* New style function update */
-			else if (words[0][0] == 'F' && words[0][1] == 0 && wordNum == 4)
-			{
-				int trainID = atoi(words[1]);
-				int funcID = atoi(words[2]);
-				int active = atoi(words[3]);
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  P O S T                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Pass the event filled in after connectEventNew over to the main loop.
+ *  \param trackCtrl Which is the active track.
+ *  \result None.
+ */
+static void connectEventPost (trackCtrlDef *trackCtrl)
+{
+	__atomic_store_n (&trackCtrl -> eventHead, trackCtrl -> eventHead + 1, __ATOMIC_RELEASE);
+}
 
-				trainUpdateFunction (trackCtrl, trainID, funcID, active);
-			}
-			/* Current monitor */
-			else if (words[0][0] == 'a' && words[0][1] == 0 && wordNum == 2)
-			{
-				if (trackCtrl -> powerState == POWER_ON)
-					trackCtrl -> remoteCurrent = atoi (words[1]);
-			}
-			/* Our handle number on the server, unique to this client */
-			else if (words[0][0] == 'V' && words[0][1] == 0 && (wordNum == 2 || wordNum == 8))
-			{
-				trackCtrl -> serverSession = atoi (words[1]);
-				if (wordNum == 8)
-				{
-					int i;
-					for (i = 0; i < 6; ++i)
-						trackCtrl -> connectionStatus[i] = atoi (words[i + 2]);
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  W O R D S                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Queue an event holding the numbers from a message, the command letter is not included.
+ *  \param trackCtrl Which is the active track.
+ *  \param type Type of event.
+ *  \param message Message that was received.
+ *  \result None.
+ */
+static void connectEventWords (trackCtrlDef *trackCtrl, int type, dccMessageDef *message)
+{
+	connectEventDef *event = connectEventNew (trackCtrl, type);
 
-					trackCtrl -> connectionStatus[6] = 1;
-				}
-			}
-			/* Point change update */
-			else if (words[0][0] == 'y' && words[0][1] == 0 && wordNum == 4)
-			{
-				int server = atoi (words[1]);
-				int point = atoi (words[2]);
-				int state = atoi (words[3]);
-				updatePointPosn (trackCtrl, server, point, state);
-				++queueDraw;
-			}
-			/* Point change update */
-			else if (words[0][0] == 'x' && words[0][1] == 0 && wordNum == 4)
-			{
-				int server = atoi (words[1]);
-				int signal = atoi (words[2]);
-				int state = atoi (words[3]);
-				updateSignalState (trackCtrl, server, signal, state);
-				++queueDraw;
-			}
-			/* Relay change update */
-			else if (words[0][0] == 'w' && words[0][1] == 0 && wordNum == 4)
-			{
-				int server = atoi (words[1]);
-				int relay = atoi (words[2]);
-				int state = atoi (words[3]);
-				updateRelayState (trackCtrl, server, relay, state);
-			}
-			inType = 0;
-			wordNum = -1;
-			j = 0;
-		}
-		else if (wordNum >= 0 && j > 0 && (buffer[i] == ' ' || buffer[i] == '|'))
-		{
-			words[++wordNum][0] = 0;
-			j = 0;
-		}
-		if (wordNum > 40)
+	if (event != NULL)
+	{
+		while (event -> count < 8 && event -> count + 1 < message -> wordCount)
 		{
-			words[wordNum = 40][0] = 0;
-			j = 0;
+			event -> values[event -> count] = dccWordInt (message, event -> count + 1);
+			++event -> count;
 		}
-		if (j > 40)
-			j = 40;
+		connectEventPost (trackCtrl);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  L I N K                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Queue an event to say the connection to the daemon has been made or lost. A new connection asks for
+ *  binary frames, they are not used until the daemon agrees.
+ *  \param trackCtrl Which is the active track.
+ *  \param state 1 if connected, 0 if not.
+ *  \result None.
+ */
+static void connectEventLink (trackCtrlDef *trackCtrl, int state)
+{
+	connectEventDef *event = connectEventNew (trackCtrl, CONNECT_EV_LINK);
+
+	__atomic_store_n (&trackCtrl -> frameVersion, 0, __ATOMIC_RELEASE);
+	if (state)
+	{
+		char tempBuff[DCC_FORMAT_SIZE];
+		int version = DCC_FRAME_VERSION;
 
-		++i;
+		trainConnectSend (trackCtrl, tempBuff, dccFormat (tempBuff, 0, DCC_FRAME_OPCODE, 1, &version));
 	}
-	if (queueDraw)
+
+	if (event != NULL)
 	{
-		if (trackCtrl -> windowTrack != NULL)
-			gtk_widget_queue_draw (trackCtrl -> drawingArea);
+		event -> values[0] = state;
+		event -> count = 1;
+		connectEventPost (trackCtrl);
+		connectEventWake (trackCtrl);
 	}
-	if (j || wordNum >= 0)
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  P O W E R  S T A T E                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Track power status.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectPowerState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_POWER, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  T H R O T T L E  S T A T E                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Throttle status.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectThrottleState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_THROTTLE, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  R E A D  C V                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read CV value, only if it was our request.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectReadCv (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_READCV, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  F U N C T I O N  S T A T E                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief New style function update.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectFunctionState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_FUNCTION, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  F U N C T I O N  B I T S                                                                           *
+ *  =======================================                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief All the functions for some trains, each train is followed by the words of its function bitset, lowest
+ *  first.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectFunctionBits (dccMessageDef *message, int handle, void *userData)
+{
+	int w;
+	trackCtrlDef *trackCtrl = (trackCtrlDef *)userData;
+
+	for (w = 1; w + FUNC_WORDS < message -> wordCount; w += FUNC_WORDS + 1)
 	{
-		printf ("Rxed incomplete:[%s]\n", buffer);
+		connectEventDef *event = connectEventNew (trackCtrl, CONNECT_EV_FUNCBITS);
+
+		if (event != NULL)
+		{
+			int i;
+
+			event -> values[0] = dccWordInt (message, w);
+			for (i = 0; i < FUNC_WORDS; ++i)
+				event -> values[i + 1] = dccWordInt (message, w + i + 1);
+
+			event -> count = FUNC_WORDS + 1;
+			connectEventPost (trackCtrl);
+		}
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  C U R R E N T                                                                                      *
+ *  ============================                                                                                      *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Current monitor.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectCurrent (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_CURRENT, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  S E S S I O N                                                                                      *
+ *  ============================                                                                                      *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Our handle number on the server, unique to this client, and maybe the server status.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectSession (dccMessageDef *message, int handle, void *userData)
+{
+	if (message -> wordCount == 2 || message -> wordCount == 8)
+		connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_SESSION, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  P O I N T  S T A T E                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Point change update.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectPointState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_POINT, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  S I G N A L  S T A T E                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Signal change update.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectSignalState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_SIGNAL, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  R E L A Y  S T A T E                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Relay change update.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectRelayState (dccMessageDef *message, int handle, void *userData)
+{
+	connectEventWords ((trackCtrlDef *)userData, CONNECT_EV_RELAY, message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  F R A M E S                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief The daemon has agreed to binary frames, use them for the busy messages from now on.
+ *  \param message Message that was received.
+ *  \param handle Socket it was received on.
+ *  \param userData Which is the active track.
+ *  \result None.
+ */
+void connectFrames (dccMessageDef *message, int handle, void *userData)
+{
+	trackCtrlDef *trackCtrl = (trackCtrlDef *)userData;
+	int version = dccWordInt (message, 1);
+
+	__atomic_store_n (&trackCtrl -> frameVersion, version > DCC_FRAME_VERSION ? DCC_FRAME_VERSION : version,
+			__ATOMIC_RELEASE);
+}
+
+dccCommandDef connectCommands[] =
+{
+	{	'p',	2,	3,	connectPowerState		},
+	{	'T',	4,	4,	connectThrottleState	},
+	{	'r',	5,	5,	connectReadCv			},
+	{	'F',	4,	4,	connectFunctionState	},
+	{	'G',	FUNC_WORDS + 2,	-1,	connectFunctionBits		},
+	{	'a',	2,	2,	connectCurrent			},
+	{	'V',	2,	8,	connectSession			},
+	{	'y',	4,	4,	connectPointState		},
+	{	'x',	4,	4,	connectSignalState		},
+	{	'w',	4,	4,	connectRelayState		},
+	{	'K',	2,	2,	connectFrames			},
+	{	0,		0,	-1,	NULL					}
+};
+dccDispatchDef connectDispatch;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C H E C K  R E C V  B U F F E R                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Chech what we have received on the socket, changes are queued and the main loop is woken once.
+ *  \param trackCtrl Which is the active track.
+ *  \param rxedStream Stream that keeps any incomplete message.
+ *  \param buffer Buffer that was received.
+ *  \param len Length of the buffer.
+ *  \result None.
+ */
+void checkRecvBuffer (trackCtrlDef *trackCtrl, dccStreamDef *rxedStream, char *buffer, int len)
+{
+/*------------------------------------------------------------------*
+	printf ("Rxed:[%s]\n", buffer);
+*------------------------------------------------------------------*/
+	unsigned int head = trackCtrl -> eventHead;
+
+	dccParseStream (rxedStream, &connectDispatch, buffer, len, trackCtrl -> serverHandle, trackCtrl);
+	if (trackCtrl -> eventHead != head)
+		connectEventWake (trackCtrl);
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  T R A I N  C O N N E C T  T H R E A D                                                                             *
@@ -231,8 +457,12 @@ void *trainConnectThread (void *arg)
 	fd_set readfds;
 	time_t holdOff = 0;
 	struct timeval timeout;
+	dccStreamDef rxedStream;
 	trackCtrlDef *trackCtrl = (trackCtrlDef *)arg;
 
+	dccStreamInit (&rxedStream, 1024);
+	dccDispatchInit (&connectDispatch, connectCommands);
+
 	trackCtrl -> connectRunning = 1;
 	trackCtrl -> serverHandle = -1;
 
@@ -247,6 +477,8 @@ void *trainConnectThread (void *arg)
 				trackCtrl -> serverHandle = ConnectClientSocket (trackCtrl -> server, trackCtrl -> serverPort,
 						trackCtrl -> conTimeout, trackCtrl -> ipVersion, trackCtrl -> addressBuffer);
 				holdOff = now + 10;
+				if (trackCtrl -> serverHandle != -1)
+					connectEventLink (trackCtrl, 1);
 			}
 			if (trackCtrl -> serverHandle == -1)
 				sleep (1);
@@ -261,7 +493,11 @@ void *trainConnectThread (void *arg)
 
 			selRetn = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
 			if (selRetn == -1)
+			{
 				CloseSocket (&trackCtrl -> serverHandle);
+				dccStreamFree (&rxedStream);
+				connectEventLink (trackCtrl, 0);
+			}
 
 			if (selRetn > 0)
 			{
@@ -273,11 +509,13 @@ void *trainConnectThread (void *arg)
 					if ((readBytes = RecvSocket (trackCtrl -> serverHandle, buffer, 10240)) > 0)
 					{
 						buffer[readBytes] = 0;
-						checkRecvBuffer (trackCtrl, buffer, readBytes);
+						checkRecvBuffer (trackCtrl, &rxedStream, buffer, readBytes);
 					}
 					else if (readBytes == 0)
 					{
 						CloseSocket (&trackCtrl -> serverHandle);
+						dccStreamFree (&rxedStream);
+						connectEventLink (trackCtrl, 0);
 					}
 				}
 			}
@@ -286,6 +524,7 @@ void *trainConnectThread (void *arg)
 	if (trackCtrl -> serverHandle != -1)
 		CloseSocket (&trackCtrl -> serverHandle);
 
+	dccStreamFree (&rxedStream);
 	return NULL;
 }
 
@@ -312,6 +551,50 @@ int trainConnectSend (trackCtrlDef *trackCtrl, char *buffer, int len)
 	return retn;
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T R A I N  C O N N E C T  V A L U E S                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send a message made of an opcode and numbers, as a binary frame if the daemon has agreed to them.
+ *  \param trackCtrl Which is the active track.
+ *  \param opcode Opcode of the message.
+ *  \param count Number of values.
+ *  \param values Values to send.
+ *  \result Number of bytes sent.
+ */
+int trainConnectValues (trackCtrlDef *trackCtrl, char opcode, int count, int *values)
+{
+	char tempBuff[DCC_FORMAT_SIZE];
+	int frames = __atomic_load_n (&trackCtrl -> frameVersion, __ATOMIC_ACQUIRE);
+
+	return trainConnectSend (trackCtrl, tempBuff, dccFormat (tempBuff, frames, opcode, count, values));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T R A I N  C O N N E C T  S T A T E                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send a point, signal or relay change to the daemon.
+ *  \param trackCtrl Which is the active track.
+ *  \param opcode Y for a point, X for a signal or W for a relay.
+ *  \param server Identity of the point server.
+ *  \param ident Identity of the point, signal or relay.
+ *  \param state New state.
+ *  \result Number of bytes sent.
+ */
+int trainConnectState (trackCtrlDef *trackCtrl, char opcode, int server, int ident, int state)
+{
+	int values[3] = { server, ident, state };
+
+	return trainConnectValues (trackCtrl, opcode, 3, values);
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  T R A I N  S E T  S P E E D                                                                                       *
@@ -328,11 +611,11 @@ int trainConnectSend (trackCtrlDef *trackCtrl, char *buffer, int len)
 int trainSetSpeed (trackCtrlDef *trackCtrl, trainCtrlDef *train, int speed)
 {
 	int retn = 0;
-	char tempBuff[81];
+	int values[4] = { train -> trainReg, train -> trainID, speed, train -> reverse };
 
-	sprintf (tempBuff, "<t %d %d %d %d>", train -> trainReg, train -> trainID, speed, train -> reverse);
-	if (trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff)) > 0)
+	if (trainConnectValues (trackCtrl, 't', 4, values) > 0)
 	{
+		char tempBuff[81];
 		char speedStr[21] = "STOP";
 		if (speed >=0)
 			sprintf (speedStr, "%d", speed);
@@ -361,15 +644,14 @@ int trainSetSpeed (trackCtrlDef *trackCtrl, trainCtrlDef *train, int speed)
 int trainToggleFunction (trackCtrlDef *trackCtrl, trainCtrlDef *train, int funcID, int state)
 {
 	int retn = 0;
-	if (funcID >= 0 && funcID < 100)
+	if (funcID >= 0 && funcID < FUNC_MAX)
 	{
 		char tempBuff[81];
+		int values[3] = { train -> trainID, funcID, state };
 
-		sprintf (tempBuff, "<F %d %d %d>", train -> trainID, funcID, state);
-
-		if (trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff)) > 0)
+		if (trainConnectValues (trackCtrl, 'F', 3, values) > 0)
 		{
-			train -> funcState[funcID] = state;
+			FUNC_SET (train, funcID, state);
 			sprintf (tempBuff, "Set function: %d to %s for train %d", funcID, state ? "on" : "off", train -> trainNum);
 			gtk_statusbar_push (GTK_STATUSBAR (trackCtrl -> statusBar), 1, tempBuff);
 			retn = 1;
@@ -385,7 +667,7 @@ int trainToggleFunction (trackCtrlDef *trackCtrl, trainCtrlDef *train, int funcI
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Update the fuctions register from remote update.
+ *  \brief Update the fuctions register from remote update, and flag the switch to be updated.
  *  \param trackCtrl Track configuration.
  *  \param trainID Which train cab number.
  *  \param funcID Which function is being changed.
@@ -394,15 +676,164 @@ int trainToggleFunction (trackCtrlDef *trackCtrl, trainCtrlDef *train, int funcI
  */
 void trainUpdateFunction (trackCtrlDef *trackCtrl, int trainID, int funcID, int state)
 {
-	int t;
-	for (t = 0; t < trackCtrl -> trainCount; ++t)
+	int j;
+	trainCtrlDef *train = findTrainByID (trackCtrl, trainID);
+
+	if (train != NULL)
+	{
+		FUNC_SET (train, funcID, state);
+		for (j = 0; j < train -> funcCount; ++j)
+		{
+			if (train -> trainFunc[j].funcID == funcID)
+			{
+				train -> trainFunc[j].changed = 1;
+				train -> changed |= CHANGED_FUNC;
+				trackCtrl -> changed |= CHANGED_TRAIN;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  A P P L Y                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Make the change from one event, called on the main loop so the GUI can be updated.
+ *  \param trackCtrl Which is the active track.
+ *  \param event Event from the ring.
+ *  \result None.
+ */
+static void connectEventApply (trackCtrlDef *trackCtrl, connectEventDef *event)
+{
+	int *values = event -> values, i;
+	trainCtrlDef *train;
+
+	switch (event -> type)
+	{
+	case CONNECT_EV_POWER:
+		trackCtrl -> remotePowerState = values[0];
+		if (!values[0])
+			trackCtrl -> remoteCurrent = -1;
+		break;
+
+	case CONNECT_EV_THROTTLE:
+		if ((train = findTrainByReg (trackCtrl, values[0])) != NULL)
+		{
+			train -> remoteCurSpeed = values[1];
+			train -> remoteReverse = values[2];
+			train -> changed |= CHANGED_SPEED;
+			trackCtrl -> changed |= CHANGED_TRAIN;
+		}
+		break;
+
+	case CONNECT_EV_READCV:
+		if (values[0] == trackCtrl -> serverSession)
+		{
+			char binary[9];
+			int mask = 0x80;
+			for (i = 0; i < 8; ++i)
+			{
+				binary[i] = (values[3] & mask ? '1' : '0');
+				mask >>= 1;
+			}
+			binary[i] = 0;
+			snprintf (trackCtrl -> remoteProgMsg, 110, "Read CV#%d value: %d [%s]", values[2], values[3], binary);
+		}
+		break;
+
+	case CONNECT_EV_FUNCTION:
+		if (values[1] >= 0 && values[1] < FUNC_MAX)
+			trainUpdateFunction (trackCtrl, values[0], values[1], values[2]);
+		break;
+
+	case CONNECT_EV_FUNCBITS:
+		if ((train = findTrainByID (trackCtrl, values[0])) != NULL)
+		{
+			for (i = 0; i < train -> funcCount; ++i)
+			{
+				int funcID = train -> trainFunc[i].funcID;
+				if (FUNC_STATE (train, funcID) != (((unsigned int)values[(funcID >> 5) + 1] >> (funcID & 31)) & 1))
+				{
+					train -> trainFunc[i].changed = 1;
+					train -> changed |= CHANGED_FUNC;
+					trackCtrl -> changed |= CHANGED_TRAIN;
+				}
+			}
+			for (i = 0; i < FUNC_WORDS; ++i)
+				train -> funcState[i] = (unsigned int)values[i + 1];
+		}
+		break;
+
+	case CONNECT_EV_CURRENT:
+		if (trackCtrl -> powerState == POWER_ON)
+			trackCtrl -> remoteCurrent = values[0];
+		break;
+
+	case CONNECT_EV_SESSION:
+		trackCtrl -> serverSession = values[0];
+		if (event -> count == 7)
+		{
+			for (i = 0; i < 6; ++i)
+				trackCtrl -> connectionStatus[i] = values[i + 1];
+
+			trackCtrl -> connectionStatus[6] = 1;
+		}
+		break;
+
+	case CONNECT_EV_POINT:
+		updatePointPosn (trackCtrl, values[0], values[1], values[2]);
+		break;
+
+	case CONNECT_EV_SIGNAL:
+		updateSignalState (trackCtrl, values[0], values[1], values[2]);
+		break;
+
+	case CONNECT_EV_RELAY:
+		updateRelayState (trackCtrl, values[0], values[1], values[2]);
+		break;
+
+	case CONNECT_EV_LINK:
+		++trackCtrl -> trackGeneration;
+		break;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O N N E C T  E V E N T  C A L L B A C K                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief The connection thread has woken the main loop, take all the events from the ring and update the display.
+ *  \param handle The eventfd handle.
+ *  \param condition Not used.
+ *  \param data Which is the active track.
+ *  \result TRUE so the source is kept.
+ */
+static gboolean connectEventCallback (gint handle, GIOCondition condition, gpointer data)
+{
+	uint64_t count;
+	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
+	unsigned int tail = trackCtrl -> eventTail;
+	unsigned int head = __atomic_load_n (&trackCtrl -> eventHead, __ATOMIC_ACQUIRE);
+
+	if (read (handle, &count, sizeof (count)) < 0)
+		count = 0;
+
+	if (tail != head)
 	{
-		if (trackCtrl -> trainCtrl[t].trainID == trainID)
+		while (tail != head)
 		{
-			trackCtrl -> trainCtrl[t].funcState[funcID] = state;
-			break;
+			connectEventApply (trackCtrl, &trackCtrl -> eventRing[tail & CONNECT_RING_MASK]);
+			__atomic_store_n (&trackCtrl -> eventTail, ++tail, __ATOMIC_RELEASE);
 		}
+		updateRemoteDisplay (trackCtrl);
 	}
+	return TRUE;
 }
 
 /**********************************************************************************************************************
@@ -412,13 +843,36 @@ void trainUpdateFunction (trackCtrlDef *trackCtrl, int trainID, int funcID, int
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Start the thread controlling the connection.
+ *  \brief Start the thread controlling the connection, and the ring it uses to pass changes to the main loop.
  *  \param trackCtrl Which is the active track.
  *  \result 1 if thread started (may not be connected).
  */
 int startConnectThread(trackCtrlDef *trackCtrl)
 {
-	int retn = pthread_create (&trackCtrl -> connectHandle, NULL, trainConnectThread, trackCtrl);
+	int retn = -1;
+
+	trackCtrl -> eventHead = trackCtrl -> eventTail = 0;
+	trackCtrl -> eventRing = (connectEventDef *)malloc (CONNECT_RING_SIZE * sizeof (connectEventDef));
+	trackCtrl -> eventHandle = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (trackCtrl -> eventRing != NULL && trackCtrl -> eventHandle != -1)
+	{
+		trackCtrl -> eventSource = g_unix_fd_add (trackCtrl -> eventHandle, G_IO_IN, connectEventCallback, trackCtrl);
+		retn = pthread_create (&trackCtrl -> connectHandle, NULL, trainConnectThread, trackCtrl);
+		if (retn != 0)
+		{
+			g_source_remove (trackCtrl -> eventSource);
+			trackCtrl -> eventSource = 0;
+		}
+	}
+	if (retn != 0)
+	{
+		if (trackCtrl -> eventHandle != -1)
+			close (trackCtrl -> eventHandle);
+		free (trackCtrl -> eventRing);
+		trackCtrl -> eventHandle = -1;
+		trackCtrl -> eventRing = NULL;
+	}
 	return (retn == 0 ? 1 : 0);
 }
 
@@ -438,6 +892,19 @@ void stopConnectThread(trackCtrlDef *trackCtrl)
 	trackCtrl -> connectRunning = 0;
 	pthread_join (trackCtrl -> connectHandle, NULL);
 
+	if (trackCtrl -> eventSource != 0)
+	{
+		g_source_remove (trackCtrl -> eventSource);
+		trackCtrl -> eventSource = 0;
+	}
+	if (trackCtrl -> eventHandle != -1)
+	{
+		close (trackCtrl -> eventHandle);
+		trackCtrl -> eventHandle = -1;
+	}
+	free (trackCtrl -> eventRing);
+	trackCtrl -> eventRing = NULL;
+
 	if (trackCtrl -> throttlesRunning && trackCtrl -> throttlesHandle != 0)
 	{
 		trackCtrl -> throttlesRunning = 0;
@@ -67,6 +67,8 @@ static GdkPixbuf *defaultIcon;
 
 #define UPDATE_HOLD 500
 #define BUTTON_HOLD 500
+#define DRAW_STATIC 1
+#define DRAW_DYNAMIC 2
 
 /**********************************************************************************************************************
  *                                                                                                                    *
@@ -176,9 +178,14 @@ static void sendButtonFunc (GtkWidget *widget, gpointer data)
 	int funcID = train -> trainFunc[index].funcID;
 	int active = gtk_switch_get_active (GTK_SWITCH (widget)) ? 1 : 0;
 
-	if (active != train -> funcState[funcID])
+	if (active != FUNC_STATE (train, funcID))
 	{
-		trainToggleFunction (trackCtrl, train, funcID, active);
+		if (!trainToggleFunction (trackCtrl, train, funcID, active))
+		{
+			train -> trainFunc[index].changed = 1;
+			train -> changed |= CHANGED_FUNC;
+			trackCtrl -> changed |= CHANGED_TRAIN;
+		}
 	}
 }
 
@@ -204,10 +211,8 @@ static void sendButtonRelay (GtkWidget *widget, gpointer data)
 
 	if (active != trackCtrl -> relays[index].active)
 	{
-		char tempBuff[81];
 		trackCtrl -> relays[index].active = active;
-		sprintf (tempBuff, "<W %d %d %d>", trackCtrl -> relays[index].server, relayID, active);
-		trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff));
+		trainConnectState (trackCtrl, 'W', trackCtrl -> relays[index].server, relayID, active);
 	}
 }
 
@@ -305,6 +310,8 @@ static void trainFunctions (GtkWidget *widget, gpointer data)
 			gtk_grid_attach (GTK_GRID(grid), label, 0, row, 1, 1);
 
 			train -> trainFunc[i].funcSwitch = button = gtk_switch_new();
+			gtk_switch_set_active (GTK_SWITCH (button), FUNC_STATE (train, train -> trainFunc[i].funcID) ? TRUE : FALSE);
+			train -> trainFunc[i].changed = 0;
 			g_object_set_data (G_OBJECT(button), "track", trackCtrl);
 			g_object_set_data (G_OBJECT(button), "train", train);
 			g_object_set_data (G_OBJECT(button), "index", (void *)i);
@@ -571,38 +578,172 @@ static void reverseTrain (GtkWidget *widget, gpointer data)
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  D R A W  T R A C K  C A L L B A C K                                                                               *
- *  ===================================                                                                               *
+ *  D R A W  T R A C K  C E L L                                                                                       *
+ *  ===========================                                                                                       *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Draw the track.
- *  \param widget Button that was pressed.
+ *  \brief Draw one cell of the track, cells with points or signals change so they are drawn in the dynamic layer.
  *  \param cr Cairo context.
- *  \param data Track to draw.
- *  \result FALSE.
+ *  \param cell Cell to draw.
+ *  \param i Row of the cell.
+ *  \param j Column of the cell.
+ *  \param cellSize Size of a cell.
+ *  \param layer DRAW_STATIC or DRAW_DYNAMIC.
+ *  \result None.
  */
-gboolean drawTrackCallback (GtkWidget *widget, cairo_t *cr, gpointer data)
+static void drawTrackCell (cairo_t *cr, trackCellDef *cell, int i, int j, int cellSize, int layer)
 {
-	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
-
 	double lineWidths[2];
-	int i, j, xChangeMod[8], yChangeMod[8];
-	int rows = trackCtrl -> trackLayout -> trackRows;
-	int cols = trackCtrl -> trackLayout -> trackCols;
-	int cellSize = trackCtrl -> trackLayout -> trackSize;
-	int cellHalf = cellSize >> 1;
-	guint width = gtk_widget_get_allocated_width (widget);
-	guint height = gtk_widget_get_allocated_height (widget);
-	GtkStyleContext *context = gtk_widget_get_style_context (widget);
+	int lineType, xPos[5]={0,0,0,0,0}, yPos[5]={0,0,0,0,0}, posMask = 0, saveVal = 0;
+	int count = 0, loop, xChangeMod[8], yChangeMod[8], cellHalf = cellSize >> 1;
+
+	if (!(layer & (cell -> point.point || cell -> signal.signal ? DRAW_DYNAMIC : DRAW_STATIC)))
+		return;
 
 	lineWidths[0] = (double)cellSize / 4;
 	lineWidths[1] = (double)cellSize / 8;
-	for (i = 0; i < 8; ++i)
+	for (loop = 0; loop < 8; ++loop)
+	{
+		xChangeMod[loop] = xChange[loop] * cellHalf;
+		yChangeMod[loop] = yChange[loop] * cellHalf;
+	}
+
+	for (loop = 0; loop < 8; ++loop)
+	{
+		if (cell -> layout & (1 << loop))
+		{
+			++count;
+			if (cell -> point.point & (1 << loop))
+			{
+				if (!(cell -> point.state & (1 << loop)))
+				{
+					xPos[4] = (j * cellSize) + xChangeMod[loop];
+					yPos[4] = (i * cellSize) + yChangeMod[loop];
+					posMask |= 16;
+				}
+				else if (saveVal < 4)
+				{
+					xPos[saveVal] = (j * cellSize) + xChangeMod[loop];
+					yPos[saveVal] = (i * cellSize) + yChangeMod[loop];
+					posMask |= (1 << saveVal++);
+				}
+			}
+			else
+			{
+				if (saveVal < 4)
+				{
+					xPos[saveVal] = (j * cellSize) + xChangeMod[loop];
+					yPos[saveVal] = (i * cellSize) + yChangeMod[loop];
+					posMask |= (1 << saveVal++);
+				}
+			}
+		}
+		if (cell -> signal.signal & (1 << loop))
+		{
+			cairo_save (cr);
+			if (cell -> signal.state == 1)
+				gdk_cairo_set_source_rgba (cr, &sigRedCol);
+			else if (cell -> signal.state == 2)
+				gdk_cairo_set_source_rgba (cr, &sigGrnCol);
+			else
+				gdk_cairo_set_source_rgba (cr, &sigOffCol);
+
+			cairo_arc (cr,
+					(j * cellSize) + (cellSize >> 2) + (xChangeMod[loop] >> 1),
+					(i * cellSize) + (cellSize >> 2) + (yChangeMod[loop] >> 1),
+					(double)cellSize / 8.5, 0, 2 * G_PI);
+			cairo_fill (cr);
+			cairo_stroke (cr);
+
+			gdk_cairo_set_source_rgba (cr, &sigOutCol);
+			cairo_arc (cr,
+					(j * cellSize) + (cellSize >> 2) + (xChangeMod[loop] >> 1),
+					(i * cellSize) + (cellSize >> 2) + (yChangeMod[loop] >> 1),
+					(double)cellSize / 8.5, 0, 2 * G_PI);
+			cairo_stroke (cr);
+
+			cairo_restore (cr);
+		}
+	}
+	if (posMask & 16)
+	{
+		for (lineType = 0; lineType < 2; ++lineType)
+		{
+			cairo_save (cr);
+			cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+			gdk_cairo_set_source_rgba (cr, lineType ? &iaFillCol : &inactCol);
+			cairo_set_line_width (cr, lineWidths[lineType]);
+			cairo_move_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
+			cairo_line_to (cr, xPos[4], yPos[4]);
+			cairo_stroke (cr);
+			cairo_restore (cr);
+		}
+	}
+	if (posMask & 1)
 	{
-		xChangeMod[i] = xChange[i] * cellHalf;
-		yChangeMod[i] = yChange[i] * cellHalf;
+		for (lineType = 0; lineType < 2; ++lineType)
+		{
+			cairo_save (cr);
+			cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+			gdk_cairo_set_source_rgba (cr, lineType ? &trFillCol : &trackCol);
+			cairo_set_line_width (cr, lineWidths[lineType]);
+			cairo_move_to (cr, xPos[0], yPos[0]);
+			cairo_line_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
+			if (posMask & 2)
+			{
+				cairo_line_to (cr, xPos[1], yPos[1]);
+				if (posMask & 4)
+				{
+					cairo_move_to (cr, xPos[2], yPos[2]);
+					cairo_line_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
+					if (posMask & 8)
+					{
+						cairo_line_to (cr, xPos[3], yPos[3]);
+					}
+				}
+			}
+			cairo_stroke (cr);
+			cairo_restore (cr);
+		}
+	}
+	if (count == 1)
+	{
+		gdk_cairo_set_source_rgba (cr, &bufferCol);
+		cairo_arc (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf, (double)cellSize / 8.5, 0, 2 * G_PI);
+		cairo_fill (cr);
+		cairo_stroke (cr);
+
+		gdk_cairo_set_source_rgba (cr, &circleCol);
+		cairo_arc (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf, (double)cellSize / 8.5, 0, 2 * G_PI);
+		cairo_stroke (cr);
 	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D R A W  T R A C K  S T A T I C                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Draw the parts of the track that do not change, the background, grid and plain track.
+ *  \param widget Widget being drawn.
+ *  \param cr Cairo context to draw on.
+ *  \param trackCtrl Track to draw.
+ *  \param width Width to draw.
+ *  \param height Height to draw.
+ *  \result None.
+ */
+static void drawTrackStatic (GtkWidget *widget, cairo_t *cr, trackCtrlDef *trackCtrl, int width, int height)
+{
+	int i, j;
+	trackCellDef *cell;
+	cellIterDef cellIter;
+	int rows = trackCtrl -> trackLayout -> trackRows;
+	int cols = trackCtrl -> trackLayout -> trackCols;
+	int cellSize = trackCtrl -> trackLayout -> trackSize;
+	GtkStyleContext *context = gtk_widget_get_style_context (widget);
 
 	cairo_save (cr);
 	gtk_render_background (context, cr, 0, 0, width, height);
@@ -628,123 +769,87 @@ gboolean drawTrackCallback (GtkWidget *widget, cairo_t *cr, gpointer data)
 	cairo_stroke (cr);
 	cairo_restore (cr);
 
-	for (i = 0; i < rows; ++i)
+	for (cell = trackCellFirst (trackCtrl -> trackLayout, &cellIter, 0, 0, rows, cols); cell != NULL;
+			cell = trackCellNext (trackCtrl -> trackLayout, &cellIter))
 	{
-		for (j = 0; j < cols; ++j)
-		{
-			int lineType, xPos[5]={0,0,0,0,0}, yPos[5]={0,0,0,0,0}, posMask = 0, saveVal = 0;
-			int posn = (i * cols) + j, count = 0, loop;
+		drawTrackCell (cr, cell, cellIter.row, cellIter.col, cellSize, DRAW_STATIC);
+	}
+}
 
-			for (loop = 0; loop < 8; ++loop)
-			{
-				if (trackCtrl -> trackLayout -> trackCells[posn].layout & (1 << loop))
-				{
-					++count;
-					if (trackCtrl -> trackLayout -> trackCells[posn].point.point & (1 << loop))
-					{
-						if (!(trackCtrl -> trackLayout -> trackCells[posn].point.state & (1 << loop)))
-						{
-							xPos[4] = (j * cellSize) + xChangeMod[loop];
-							yPos[4] = (i * cellSize) + yChangeMod[loop];
-							posMask |= 16;
-						}
-						else if (saveVal < 4)
-						{
-							xPos[saveVal] = (j * cellSize) + xChangeMod[loop];
-							yPos[saveVal] = (i * cellSize) + yChangeMod[loop];
-							posMask |= (1 << saveVal++);
-						}
-					}
-					else
-					{
-						if (saveVal < 4)
-						{
-							xPos[saveVal] = (j * cellSize) + xChangeMod[loop];
-							yPos[saveVal] = (i * cellSize) + yChangeMod[loop];
-							posMask |= (1 << saveVal++);
-						}
-					}
-				}
-				if (trackCtrl -> trackLayout -> trackCells[posn].signal.signal & (1 << loop))
-				{
-					cairo_save (cr);
-					if (trackCtrl -> trackLayout -> trackCells[posn].signal.state == 1)
-						gdk_cairo_set_source_rgba (cr, &sigRedCol);
-					else if (trackCtrl -> trackLayout -> trackCells[posn].signal.state == 2)
-						gdk_cairo_set_source_rgba (cr, &sigGrnCol);
-					else
-						gdk_cairo_set_source_rgba (cr, &sigOffCol);
-
-					cairo_arc (cr,
-							(j * cellSize) + (cellSize >> 2) + (xChangeMod[loop] >> 1),
-							(i * cellSize) + (cellSize >> 2) + (yChangeMod[loop] >> 1),
-							(double)cellSize / 8.5, 0, 2 * G_PI);
-					cairo_fill (cr);
-					cairo_stroke (cr);
-
-					gdk_cairo_set_source_rgba (cr, &sigOutCol);
-					cairo_arc (cr,
-							(j * cellSize) + (cellSize >> 2) + (xChangeMod[loop] >> 1),
-							(i * cellSize) + (cellSize >> 2) + (yChangeMod[loop] >> 1),
-							(double)cellSize / 8.5, 0, 2 * G_PI);
-					cairo_stroke (cr);
-
-					cairo_restore (cr);
-				}
-			}
-			if (posMask & 16)
-			{
-				for (lineType = 0; lineType < 2; ++lineType)
-				{
-					cairo_save (cr);
-					cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
-					gdk_cairo_set_source_rgba (cr, lineType ? &iaFillCol : &inactCol);
-					cairo_set_line_width (cr, lineWidths[lineType]);
-					cairo_move_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
-					cairo_line_to (cr, xPos[4], yPos[4]);
-					cairo_stroke (cr);
-					cairo_restore (cr);
-				}
-			}
-			if (posMask & 1)
-			{
-				for (lineType = 0; lineType < 2; ++lineType)
-				{
-					cairo_save (cr);
-					cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
-					gdk_cairo_set_source_rgba (cr, lineType ? &trFillCol : &trackCol);
-					cairo_set_line_width (cr, lineWidths[lineType]);
-					cairo_move_to (cr, xPos[0], yPos[0]);
-					cairo_line_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
-					if (posMask & 2)
-					{
-						cairo_line_to (cr, xPos[1], yPos[1]);
-						if (posMask & 4)
-						{
-							cairo_move_to (cr, xPos[2], yPos[2]);
-							cairo_line_to (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf);
-							if (posMask & 8)
-							{
-								cairo_line_to (cr, xPos[3], yPos[3]);
-							}
-						}
-					}
-					cairo_stroke (cr);
-					cairo_restore (cr);
-				}
-			}
-			if (count == 1)
-			{
-				gdk_cairo_set_source_rgba (cr, &bufferCol);
-				cairo_arc (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf, (double)cellSize / 8.5, 0, 2 * G_PI);
-				cairo_fill (cr);
-				cairo_stroke (cr);
-
-				gdk_cairo_set_source_rgba (cr, &circleCol);
-				cairo_arc (cr, (j * cellSize) + cellHalf, (i * cellSize) + cellHalf, (double)cellSize / 8.5, 0, 2 * G_PI);
-				cairo_stroke (cr);
-			}
-		}
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  I N V A L I D A T E  T R A C K  S U R F A C E                                                                     *
+ *  =============================================                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Throw away the cached drawing of the track, so it is drawn again next time.
+ *  \param trackCtrl Track to invalidate.
+ *  \result None.
+ */
+void invalidateTrackSurface (trackCtrlDef *trackCtrl)
+{
+	if (trackCtrl -> trackSurface != NULL)
+	{
+		cairo_surface_destroy (trackCtrl -> trackSurface);
+		trackCtrl -> trackSurface = NULL;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D R A W  T R A C K  C A L L B A C K                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Draw the track, the parts that do not change are kept in a surface that is only drawn again when the
+ *  size changes, then the points and signals are drawn over it. Only cells inside the clip area are looked at.
+ *  \param widget Button that was pressed.
+ *  \param cr Cairo context.
+ *  \param data Track to draw.
+ *  \result FALSE.
+ */
+gboolean drawTrackCallback (GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
+
+	trackCellDef *cell;
+	cellIterDef cellIter;
+	double x1, y1, x2, y2;
+	int cellSize = trackCtrl -> trackLayout -> trackSize;
+	guint width = gtk_widget_get_allocated_width (widget);
+	guint height = gtk_widget_get_allocated_height (widget);
+
+	trackCtrl -> drawnGeneration = trackCtrl -> trackGeneration;
+	if (trackCtrl -> trackSurface != NULL && (trackCtrl -> surfaceWidth != width || trackCtrl -> surfaceHeight != height))
+		invalidateTrackSurface (trackCtrl);
+
+	if (trackCtrl -> trackSurface == NULL)
+	{
+		cairo_t *surfaceCr;
+
+		trackCtrl -> trackSurface = gdk_window_create_similar_image_surface (gtk_widget_get_window (widget),
+				CAIRO_FORMAT_RGB24, width, height, 0);
+		trackCtrl -> surfaceWidth = width;
+		trackCtrl -> surfaceHeight = height;
+
+		surfaceCr = cairo_create (trackCtrl -> trackSurface);
+		drawTrackStatic (widget, surfaceCr, trackCtrl, width, height);
+		cairo_destroy (surfaceCr);
+	}
+	cairo_set_source_surface (cr, trackCtrl -> trackSurface, 0, 0);
+	cairo_paint (cr);
+
+	/*------------------------------------------------------------------------------------------------*
+	 * Track lines go a little over the edge of a cell so include the cells just outside the clip.    *
+	 *------------------------------------------------------------------------------------------------*/
+	cairo_clip_extents (cr, &x1, &y1, &x2, &y2);
+	for (cell = trackCellFirst (trackCtrl -> trackLayout, &cellIter, ((int)y1 / cellSize) - 1, ((int)x1 / cellSize) - 1,
+			((int)y2 / cellSize) + 2, ((int)x2 / cellSize) + 2); cell != NULL;
+			cell = trackCellNext (trackCtrl -> trackLayout, &cellIter))
+	{
+		drawTrackCell (cr, cell, cellIter.row, cellIter.col, cellSize, DRAW_DYNAMIC);
 	}
 	return FALSE;
 }
@@ -774,35 +879,32 @@ gboolean windowClickCallback (GtkWidget * widget, GdkEventButton * event, gpoint
 		{
 		case GDK_BUTTON_PRIMARY:	/* left button */
 			{
-				int rows = trackCtrl -> trackLayout -> trackRows;
-				int cols = trackCtrl -> trackLayout -> trackCols;
 				int cellSize = trackCtrl -> trackLayout -> trackSize;
-				int posn = (((int)event -> y / cellSize) * cols) + ((int)event -> x / cellSize);
+				int row = (int)event -> y / cellSize, col = (int)event -> x / cellSize;
+				trackCellDef *cell = getTrackCell (trackCtrl -> trackLayout, row, col);
 
-				if (trackCtrl -> trackLayout -> trackCells[posn].point.point)
+				if (cell != NULL && cell -> point.point)
 				{
-					char tempBuff[81];
-					trackCellDef *cell = &trackCtrl -> trackLayout -> trackCells[posn];
 					unsigned short newState = cell -> point.point;
 
 					newState &= ~(cell -> point.state);
-					sprintf (tempBuff, "<Y %d %d %d>", cell -> point.server, cell -> point.ident,
-							cell -> point.pointDef == newState ? 0 : 1);
-					if (trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff)) > 0)
+					if (trainConnectState (trackCtrl, 'Y', cell -> point.server, cell -> point.ident,
+							cell -> point.pointDef == newState ? 0 : 1) > 0)
 					{
 						/* This point is linked so change the other point */
-						if (trackCtrl -> trackLayout -> trackCells[posn].point.link)
+						if (cell -> point.link)
 						{
 							int i;
 							for (i = 0; i < 8; ++i)
 							{
 								if (cell -> point.link & (1 << i))
 								{
-									int newLinkState, newPosn = posn + (cols * linkRow[i]) + linkCol[i];
-									if (newPosn >= 0 && newPosn < (rows * cols))
-									{
-										trackCellDef *newCell = &trackCtrl -> trackLayout -> trackCells[newPosn];
+									int newLinkState;
+									trackCellDef *newCell = getTrackCell (trackCtrl -> trackLayout, row + linkRow[i],
+											col + linkCol[i]);
 
+									if (newCell != NULL)
+									{
 										/* The new point should have a link, we hope to us */
 										if (newCell -> point.link)
 										{
@@ -816,9 +918,8 @@ gboolean windowClickCallback (GtkWidget * widget, GdkEventButton * event, gpoint
 												/* We are breaking the link, so set other point away from link */
 												newLinkState = newCell -> point.point & ~newCell -> point.link;
 											}
-											sprintf (tempBuff, "<Y %d %d %d>", newCell -> point.server, newCell -> point.ident,
+											trainConnectState (trackCtrl, 'Y', newCell -> point.server, newCell -> point.ident,
 													newCell -> point.pointDef == newLinkState ? 0 : 1);
-											trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff));
 										}
 									}
 								}
@@ -831,17 +932,14 @@ gboolean windowClickCallback (GtkWidget * widget, GdkEventButton * event, gpoint
 
 		case GDK_BUTTON_SECONDARY:
 			{
-				int cols = trackCtrl -> trackLayout -> trackCols;
 				int cellSize = trackCtrl -> trackLayout -> trackSize;
-				int posn = (((int)event -> y / cellSize) * cols) + ((int)event -> x / cellSize);
+				trackCellDef *cell = getTrackCell (trackCtrl -> trackLayout, (int)event -> y / cellSize,
+						(int)event -> x / cellSize);
 
-				if (trackCtrl -> trackLayout -> trackCells[posn].signal.signal)
+				if (cell != NULL && cell -> signal.signal)
 				{
-					char tempBuff[81];
-					trackCellDef *cell = &trackCtrl -> trackLayout -> trackCells[posn];
 					int newState = (cell -> signal.state == 1 ? 2 : 1);
-					sprintf (tempBuff, "<X %d %d %d>", cell -> signal.server, cell -> signal.ident, newState);
-					trainConnectSend (trackCtrl, tempBuff, strlen (tempBuff));
+					trainConnectState (trackCtrl, 'X', cell -> signal.server, cell -> signal.ident, newState);
 				}
 			}
 			return TRUE;
@@ -866,6 +964,7 @@ static void closeTrack (GtkWidget *widget, gpointer data)
 {
 	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
 	trackCtrl -> windowTrack = NULL;
+	invalidateTrackSurface (trackCtrl);
 }
 
 /**********************************************************************************************************************
@@ -882,7 +981,13 @@ static void closeTrack (GtkWidget *widget, gpointer data)
  */
 static void closeRelays (GtkWidget *widget, gpointer data)
 {
+	int i;
 	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
+
+	for (i = 0; i < trackCtrl -> relayCount; ++i)
+	{
+		trackCtrl -> relays[i].relaySwitch = NULL;
+	}
 	trackCtrl -> windowRelays = NULL;
 }
 
@@ -991,6 +1096,8 @@ static void displayRelays (GtkWidget *widget, gpointer data)
 			gtk_grid_attach (GTK_GRID(grid), label, 0, row, 1, 1);
 
 			trackCtrl -> relays[i].relaySwitch = button = gtk_switch_new();
+			gtk_switch_set_active (GTK_SWITCH (button), trackCtrl -> relays[i].active ? TRUE : FALSE);
+			trackCtrl -> relays[i].changed = 0;
 			g_object_set_data (G_OBJECT(button), "track", trackCtrl);
 			g_object_set_data (G_OBJECT(button), "index", (void *)i);
 			gtk_widget_set_halign (button, GTK_ALIGN_START);
@@ -1005,6 +1112,29 @@ static void displayRelays (GtkWidget *widget, gpointer data)
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  Q U E U E  D R A W  C E L L                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Ask for just the area of one cell to be drawn again, with a little over to cover the track width.
+ *  \param trackCtrl Track config.
+ *  \param cell Cell that has changed.
+ *  \result None.
+ */
+static void queueDrawCell (trackCtrlDef *trackCtrl, trackCellDef *cell)
+{
+	int row, col, cellSize = trackCtrl -> trackLayout -> trackSize, edge = cellSize >> 3;
+
+	if (trackCtrl -> windowTrack != NULL && getTrackCellPosn (trackCtrl -> trackLayout, cell, &row, &col))
+	{
+		gtk_widget_queue_draw_area (trackCtrl -> drawingArea, (col * cellSize) - edge, (row * cellSize) - edge,
+				cellSize + (edge << 1), cellSize + (edge << 1));
+	}
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  U P D A T E  P O I N T  P O S N                                                                                   *
@@ -1021,22 +1151,21 @@ static void displayRelays (GtkWidget *widget, gpointer data)
  */
 void updatePointPosn (trackCtrlDef *trackCtrl, int server, int point, int state)
 {
-	int i, cells = trackCtrl -> trackLayout -> trackRows * trackCtrl -> trackLayout -> trackCols;
+	trackCellDef *cell = findPointCell (trackCtrl -> trackLayout, server, point);
 
-	for (i = 0; i < cells; ++i)
+	if (cell != NULL)
 	{
-		trackCellDef *cell = &trackCtrl -> trackLayout -> trackCells[i];
-		if (cell -> point.point)
-		{
-			if (cell -> point.server == server && cell -> point.ident == point)
-			{
-				if (state == 0)
-					cell -> point.state = cell -> point.pointDef;
-				else
-					cell -> point.state = cell-> point.point & ~(cell -> point.pointDef);
+		unsigned short oldState = cell -> point.state;
 
-				break;
-			}
+		if (state == 0)
+			cell -> point.state = cell -> point.pointDef;
+		else
+			cell -> point.state = cell-> point.point & ~(cell -> point.pointDef);
+
+		if (cell -> point.state != oldState)
+		{
+			++trackCtrl -> trackGeneration;
+			queueDrawCell (trackCtrl, cell);
 		}
 	}
 }
@@ -1057,21 +1186,13 @@ void updatePointPosn (trackCtrlDef *trackCtrl, int server, int point, int state)
  */
 void updateSignalState (trackCtrlDef *trackCtrl, int server, int signal, int state)
 {
-	int i, cells = trackCtrl -> trackLayout -> trackRows * trackCtrl -> trackLayout -> trackCols;
+	trackCellDef *cell = findSignalCell (trackCtrl -> trackLayout, server, signal);
 
-	for (i = 0; i < cells; ++i)
+	if (cell != NULL && cell -> signal.state != state)
 	{
-		trackCellDef *cell = &trackCtrl -> trackLayout -> trackCells[i];
-		if (cell -> signal.signal)
-		{
-			if (cell -> signal.server == server && cell -> signal.ident == signal)
-			{
-				cell -> signal.state = state;
-				if (trackCtrl -> windowTrack != NULL)
-					gtk_widget_queue_draw (trackCtrl -> drawingArea);
-				break;
-			}
-		}
+		cell -> signal.state = state;
+		++trackCtrl -> trackGeneration;
+		queueDrawCell (trackCtrl, cell);
 	}
 }
 
@@ -1099,6 +1220,8 @@ void updateRelayState (trackCtrlDef *trackCtrl, int server, int relay, int state
 		if (relayPtr -> server == server && relayPtr -> ident == relay)
 		{
 			relayPtr -> active = state;
+			relayPtr -> changed = 1;
+			trackCtrl -> changed |= CHANGED_RELAY;
 		}
 	}
 }
@@ -1569,19 +1692,19 @@ void checkThrottleState (trackCtrlDef *trackCtrl)
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  C L O C K  T I C K  C A L L B A C K                                                                               *
- *  ===================================                                                                               *
+ *  U P D A T E  R E M O T E  D I S P L A Y                                                                           *
+ *  =======================================                                                                           *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief To update the display there is a timer.
- *  \param data Not used.
- *  \result Always true so it is called again.
+ *  \brief Show any changes made by the daemon, called when the connection has passed on some changes and from
+ *  the timer so speed changes held back by UPDATE_HOLD still get shown.
+ *  \param trackCtrl Which is the active track.
+ *  \result None.
  */
-gboolean clockTickCallback (gpointer data)
+void updateRemoteDisplay (trackCtrlDef *trackCtrl)
 {
 	int i;
-	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
 
 	if (trackCtrl -> serverHandle == -1 && trackCtrl -> connected == 1)
 	{
@@ -1594,56 +1717,74 @@ gboolean clockTickCallback (gpointer data)
 		trackCtrl -> connected = 1;
 	}
 
-	checkThrottleState (trackCtrl);
 	if (trackCtrl -> powerState != trackCtrl -> remotePowerState)
 	{
 		gtk_switch_set_active (GTK_SWITCH(trackCtrl -> buttonPower), trackCtrl -> remotePowerState == POWER_ON ? TRUE : FALSE);
 	}
-	for (i = 0; i < trackCtrl -> trainCount; ++i)
+	if (trackCtrl -> changed & CHANGED_TRAIN)
 	{
-		trainCtrlDef *train = &trackCtrl -> trainCtrl[i];
-		if (train -> curSpeed != train -> remoteCurSpeed)
+		trackCtrl -> changed &= ~CHANGED_TRAIN;
+		for (i = 0; i < trackCtrl -> trainCount; ++i)
 		{
-			if (diffTimeToNow (&train -> lastChange) > UPDATE_HOLD)
+			trainCtrlDef *train = &trackCtrl -> trainCtrl[i];
+			if (train -> changed & CHANGED_SPEED)
 			{
-				train -> curSpeed = train -> remoteCurSpeed;
-				gtk_range_set_value (GTK_RANGE (train -> scaleSpeed), (double)train -> curSpeed);
+				train -> changed &= ~CHANGED_SPEED;
+				if (train -> curSpeed != train -> remoteCurSpeed)
+				{
+					if (diffTimeToNow (&train -> lastChange) > UPDATE_HOLD)
+					{
+						train -> curSpeed = train -> remoteCurSpeed;
+						gtk_range_set_value (GTK_RANGE (train -> scaleSpeed), (double)train -> curSpeed);
+					}
+					else
+					{
+						/*----------------------------------------------------------------------------*
+						 * Held back as we changed it recently, try again on a later tick.            *
+						 *----------------------------------------------------------------------------*/
+						train -> changed |= CHANGED_SPEED;
+						trackCtrl -> changed |= CHANGED_TRAIN;
+					}
+				}
+				if (train -> reverse != train -> remoteReverse)
+				{
+					train -> reverse = train -> remoteReverse;
+					gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (train -> checkDir), train -> reverse);
+				}
 			}
-		}
-		if (train -> reverse != train -> remoteReverse)
-		{
-			train -> reverse = train -> remoteReverse;
-			gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (train -> checkDir), train -> reverse);
-		}
-		if (trackCtrl -> windowFunctions != NULL)
-		{
-			int j;
-			for (j = 0; j < train -> funcCount; ++j)
+			if (train -> changed & CHANGED_FUNC)
 			{
-				if (train -> trainFunc[j].funcSwitch != NULL)
-				{
-					int funcID = train -> trainFunc[j].funcID;
-					int active = gtk_switch_get_active (GTK_SWITCH (train -> trainFunc[j].funcSwitch)) ? 1 : 0;
+				int j;
 
-					if (active != train -> funcState[funcID])
+				train -> changed &= ~CHANGED_FUNC;
+				for (j = 0; j < train -> funcCount; ++j)
+				{
+					trainFuncDef *trainFunc = &train -> trainFunc[j];
+					if (trainFunc -> changed)
 					{
-						gtk_switch_set_active (GTK_SWITCH (train -> trainFunc[j].funcSwitch), active ? FALSE : TRUE);
+						trainFunc -> changed = 0;
+						if (trainFunc -> funcSwitch != NULL)
+						{
+							gtk_switch_set_active (GTK_SWITCH (trainFunc -> funcSwitch),
+									FUNC_STATE (train, trainFunc -> funcID) ? TRUE : FALSE);
+						}
 					}
 				}
 			}
 		}
-		if (trackCtrl -> windowRelays != NULL)
+	}
+	if (trackCtrl -> changed & CHANGED_RELAY)
+	{
+		trackCtrl -> changed &= ~CHANGED_RELAY;
+		for (i = 0; i < trackCtrl -> relayCount; ++i)
 		{
-			int j;
-			for (j = 0; j < trackCtrl -> relayCount; ++j)
+			relayDef *relayPtr = &trackCtrl -> relays[i];
+			if (relayPtr -> changed)
 			{
-				if (trackCtrl -> relays[j].relaySwitch != NULL)
+				relayPtr -> changed = 0;
+				if (relayPtr -> relaySwitch != NULL)
 				{
-					int active = gtk_switch_get_active (GTK_SWITCH (trackCtrl -> relays[j].relaySwitch)) ? 1 : 0;
-					if (active != trackCtrl -> relays[j].active)
-					{
-						gtk_switch_set_active (GTK_SWITCH (trackCtrl -> relays[j].relaySwitch), active ? FALSE : TRUE);
-					}
+					gtk_switch_set_active (GTK_SWITCH (relayPtr -> relaySwitch), relayPtr -> active ? TRUE : FALSE);
 				}
 			}
 		}
@@ -1693,14 +1834,38 @@ gboolean clockTickCallback (gpointer data)
 			trackCtrl -> connectionStatus[6] = 0;
 		}
 	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C L O C K  T I C K  C A L L B A C K                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief To update the display there is a timer.
+ *  \param data Not used.
+ *  \result Always true so it is called again.
+ */
+gboolean clockTickCallback (gpointer data)
+{
+	trackCtrlDef *trackCtrl = (trackCtrlDef *)data;
+
+	checkThrottleState (trackCtrl);
+	updateRemoteDisplay (trackCtrl);
+
 	if (trackCtrl -> windowTrack != NULL)
 	{
-		time_t now = time (NULL);
-		if (now - trackCtrl -> trackRepaint > 2)
+		/*--------------------------------------------------------------------------------------------*
+		 * Changed cells ask for their own redraw, draw it all if a change waited a whole tick.       *
+		 *--------------------------------------------------------------------------------------------*/
+		unsigned int generation = trackCtrl -> trackGeneration;
+
+		if (generation != trackCtrl -> drawnGeneration && generation == trackCtrl -> pendingGeneration)
 		{
 			gtk_widget_queue_draw (trackCtrl -> drawingArea);
-			trackCtrl -> trackRepaint = now;
 		}
+		trackCtrl -> pendingGeneration = generation;
 	}
 	if (trackCtrl -> flags & TRACK_FLAG_SHOW && trackCtrl -> serverHandle != -1)
 	{
@@ -27,6 +27,22 @@
 #define TRACK_FLAG_SLOW		1
 #define TRACK_FLAG_SHOW		2
 #define TRACK_FLAG_THRT		4
+#define CHANGED_TRAIN		1
+#define CHANGED_RELAY		2
+#define CHANGED_SPEED		4
+#define CHANGED_FUNC		8
+#define TRAIN_ID_MAX		10240
+#define FUNC_MAX			128
+#define FUNC_WORDS			(FUNC_MAX / 32)
+#define FUNC_STATE(train, func)	(((train) -> funcState[(func) >> 5] >> ((func) & 31)) & 1)
+#define FUNC_SET(train, func, state) \
+	((state) ? ((train) -> funcState[(func) >> 5] |= (1U << ((func) & 31))) : \
+	((train) -> funcState[(func) >> 5] &= ~(1U << ((func) & 31))))
+#define SLOW_CLIENT_DROP	0
+#define SLOW_CLIENT_CLOSE	1
+#define TRACK_TILE_SHIFT	4
+#define TRACK_TILE_SIZE		(1 << TRACK_TILE_SHIFT)
+#define TRACK_TILE_MASK		(TRACK_TILE_SIZE - 1)
 
 typedef struct _pointCell
 {
@@ -56,12 +72,60 @@ typedef struct _trackCell
 }
 trackCellDef;
 
+typedef struct _trackTile
+{
+	unsigned short occupied[TRACK_TILE_SIZE];
+	trackCellDef cells[TRACK_TILE_SIZE * TRACK_TILE_SIZE];
+}
+trackTileDef;
+
+typedef struct _cellIter
+{
+	int rowStart;
+	int colStart;
+	int rowEnd;
+	int colEnd;
+	int tileRow;
+	int tileCol;
+	int row;
+	int col;
+	unsigned int bits;
+	trackTileDef *tile;
+}
+cellIterDef;
+
+typedef struct _cellIndex
+{
+	unsigned int key;
+	trackCellDef *cell;
+}
+cellIndexDef;
+
+typedef struct _serverCells
+{
+	int server;
+	int firstPoint;
+	int pointCount;
+	int firstSignal;
+	int signalCount;
+}
+serverCellsDef;
+
 typedef struct _trackLayout
 {
 	unsigned int trackRows;
 	unsigned int trackCols;
 	unsigned int trackSize;
-	trackCellDef *trackCells;
+	unsigned int tileRows;
+	unsigned int tileCols;
+	trackTileDef **trackTiles;
+
+	unsigned int indexMask;
+	cellIndexDef *pointIndex;
+	cellIndexDef *signalIndex;
+	int serverCount;
+	serverCellsDef *serverCells;
+	trackCellDef **serverCellList;
 }
 trackLayoutDef;
 
@@ -69,6 +133,7 @@ typedef struct _trainFunc
 {
 	int funcID;
 	int trigger;
+	int changed;
 	char funcDesc[41];
 #ifdef __GTK_H__
 	GtkWidget *funcSwitch;
@@ -87,8 +152,9 @@ typedef struct _trainCtrl
 	int reverse;
 	int slowSpeed;
 	int funcCount;
+	int changed;
 	char trainDesc[41];
-	char funcState[100];
+	unsigned int funcState[FUNC_WORDS];
 
 	struct timeval lastChange;
 	int remoteCurSpeed;
@@ -143,6 +209,7 @@ typedef struct _relayDef
 	int server;
 	int ident;
 	int active;
+	int changed;
 	char relayDesc[41];
 #ifdef __GTK_H__
 	GtkWidget *relaySwitch;
@@ -152,6 +219,14 @@ typedef struct _relayDef
 }
 relayDef;
 
+typedef struct _connectEvent
+{
+	int type;
+	int count;
+	int values[8];
+}
+connectEventDef;
+
 typedef struct _trackCtrl
 {
 	int connected;
@@ -162,6 +237,7 @@ typedef struct _trackCtrl
 	int relayCount;
 	int serverHandle;
 	int serverSession;
+	int frameVersion;
 	int serverPort;
 	int pointPort;
 	int configPort;
@@ -171,12 +247,18 @@ typedef struct _trackCtrl
 	int throttlesRunning;
 	int shownCurrent;
 	int flags;
+	int changed;
 	int idleOff;
+	int txQueueSize;
+	int slowClient;
+	int coalesceTime;
 	char server[81];
 	char trackName[81];
 	char serialDevice[81];
 	char throttleName[81];
-	time_t trackRepaint;
+	unsigned int trackGeneration;
+	unsigned int drawnGeneration;
+	unsigned int pendingGeneration;
 	pthread_t connectHandle;
 	pthread_t throttlesHandle;
 	pthread_mutex_t throttleMutex;
@@ -186,8 +268,17 @@ typedef struct _trackCtrl
 	int remotePowerState;
 	int remoteCurrent;
 	int connectionStatus[7];
+	int surfaceWidth;
+	int surfaceHeight;
+	int eventHandle;
+	unsigned int eventSource;
+	unsigned int eventHead;
+	unsigned int eventTail;
+	connectEventDef *eventRing;
 
 	trainCtrlDef *trainCtrl;
+	short *trainByID;
+	short *trainByReg;
 	pointCtrlDef *pointCtrl;
 	throttleDef *throttles;
 	relayDef *relays;
@@ -211,8 +302,9 @@ typedef struct _trackCtrl
 	GtkWidget *statusBar;				// 15
 	GtkWidget *buttonStopAll;			// 16
 	GtkWidget *connectionLabels[8];		// 16 + 8 = 24
+	cairo_surface_t *trackSurface;		// 25
 #else
-	void *xPointers[24];
+	void *xPointers[25];
 #endif
 }
 trackCtrlDef;
@@ -220,10 +312,26 @@ trackCtrlDef;
 void updatePointPosn (trackCtrlDef *trackCtrl, int server, int point, int state);
 void updateSignalState (trackCtrlDef *trackCtrl, int server, int signal, int state);
 void updateRelayState (trackCtrlDef *trackCtrl, int server, int relay, int state);
+void updateRemoteDisplay (trackCtrlDef *trackCtrl);
+void invalidateTrackSurface (trackCtrlDef *trackCtrl);
 int parseMemoryXML (trackCtrlDef *trackCtrl, char *buffer);
+trackCellDef *getTrackCell (trackLayoutDef *trackLayout, int row, int col);
+trackCellDef *addTrackCell (trackLayoutDef *trackLayout, int row, int col);
+int getTrackCellPosn (trackLayoutDef *trackLayout, trackCellDef *cell, int *row, int *col);
+trackCellDef *trackCellFirst (trackLayoutDef *trackLayout, cellIterDef *iter, int rowStart, int colStart,
+		int rowEnd, int colEnd);
+trackCellDef *trackCellNext (trackLayoutDef *trackLayout, cellIterDef *iter);
+int buildCellIndex (trackLayoutDef *trackLayout);
+trackCellDef *findPointCell (trackLayoutDef *trackLayout, int server, int ident);
+trackCellDef *findSignalCell (trackLayoutDef *trackLayout, int server, int ident);
+serverCellsDef *findServerCells (trackLayoutDef *trackLayout, int server);
 int parseTrackXML (trackCtrlDef *trackCtrl, const char *fileName, int level);
+trainCtrlDef *findTrainByID (trackCtrlDef *trackCtrl, int trainID);
+trainCtrlDef *findTrainByReg (trackCtrlDef *trackCtrl, int trainReg);
 int startConnectThread (trackCtrlDef *trackCtrl);
 int trainConnectSend (trackCtrlDef *trackCtrl, char *buffer, int len);
+int trainConnectValues (trackCtrlDef *trackCtrl, char opcode, int count, int *values);
+int trainConnectState (trackCtrlDef *trackCtrl, char opcode, int server, int ident, int state);
 int trainSetSpeed (trackCtrlDef *trackCtrl, trainCtrlDef *train, int speed);
 int trainToggleFunction (trackCtrlDef *trackCtrl, trainCtrlDef *train, int function, int state);
 void trainUpdateFunction (trackCtrlDef *trackCtrl, int trainID, int byteOne, int byteTwo);
@@ -32,21 +32,45 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <termios.h>
 #include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "socketC.h"
+#include "dccParse.h"
 #include "trainControl.h"
 #include "config.h"
 #include "buildDate.h"
 
 #define RXED_BUFF_SIZE	1024
-#define MAX_HANDLES		25
+#define SLAB_HANDLES	16
 #define SERIAL_HANDLE	0
 #define LISTEN_HANDLE	1
 #define POINTL_HANDLE	2
 #define CONFIG_HANDLE	3
 #define FIRST_HANDLE	4
+#define MAX_EVENTS		32
+#define ACCEPT_BACKOFF	250
+#define ARENA_START		(16 * 1024)
+#define MAX_IOV			64
+#define TXQUEUE_DEFAULT	(64 * 1024)
+#define COALESCE_DEFAULT	50
+#define FUNC_FRAME_TRAINS	((DCC_MAX_WORDS - 1) / (FUNC_WORDS + 1))
+#define SNAPSHOT_SIZE		4096
+#define SERIAL_BYTES_SEC	11520
+#define SERIAL_AHEAD_US	10000
+#define SERIAL_RING_SIZE	(64 * 1024)
+
+#define SERIAL_URGENT	0
+#define SERIAL_CONTROL	1
+#define SERIAL_POLL		2
+#define SERIAL_LANES	3
 
 #define SERIAL_HTYPE	1
 #define LISTEN_HTYPE	2
@@ -54,6 +78,7 @@
 #define CONFIG_HTYPE	4
 #define POINTC_HTYPE	5
 #define CONTRL_HTYPE	6
+#define CONFGC_HTYPE	7
 
 char *xmlBuffer;
 long xmlBufferSize;
@@ -65,22 +90,158 @@ int	 debugOutput		=	0;
 int	 goDaemon			=	0;
 int	 inDaemonise		=	0;
 int	 running			=	1;
+int	 epollFD			=	-1;
+int	 connectedCount		=	0;
+long long acceptRetryAt	=	0;
+volatile sig_atomic_t dumpStats	=	0;
+time_t curRead;
+time_t lastRxed;
+
+typedef struct _sendSeg
+{
+	int offset;
+	int len;
+}
+sendSegDef;
 
 typedef struct _handleInfo
 {
 	int handle;
 	int handleType;
-	int rxedPosn;
+	int nextFree;
 	char localName[81];
 	char remoteName[81];
-	char rxedBuff[RXED_BUFF_SIZE + 1];
+	dccStreamDef rxedStream;
+	int sendCount;
+	int sendSize;
+	int isDirty;
+	int nextDirty;
+	sendSegDef *sendSegs;
+	char *ringBuff;
+	int ringSize;
+	int ringHead;
+	int ringLen;
+	int ringKeep;
+	int dropCount;
+	int frames;
+	long configPosn;
 }
 HANDLEINFO;
 
-HANDLEINFO handleInfo[MAX_HANDLES];
+/*----------------------------------------------------------------------------------------------------*
+ * Handles live in fixed size slabs so a handle number always maps to the same memory, even when the  *
+ * table grows. Closed handles are kept on a free list and reused first.                              *
+ *----------------------------------------------------------------------------------------------------*/
+#define HINFO(h)		(handleSlabs[(h) / SLAB_HANDLES][(h) % SLAB_HANDLES])
+
+HANDLEINFO **handleSlabs	=	NULL;
+int	 slabCount				=	0;
+int	 handleCount			=	0;
+int	 firstFree				=	-1;
+
+/*----------------------------------------------------------------------------------------------------*
+ * Everything sent to the network in one pass of the loop is copied once into the send arena. Each    *
+ * handle keeps a list of the parts of the arena it needs, next to each other parts are merged, so a  *
+ * message sent to every controller is only stored once. The dirty handles are flushed with one       *
+ * sendmsg each before we wait again.                                                                 *
+ *----------------------------------------------------------------------------------------------------*/
+char *sendArena			=	NULL;
+int	 arenaUsed				=	0;
+int	 arenaSize				=	0;
+int	 firstDirty				=	-1;
+
+/*----------------------------------------------------------------------------------------------------*
+ * Throttle speeds for each train are coalesced, one is sent straight away then any more that arrive  *
+ * within the window are held, only the newest is sent when the window ends. This is done for <t> to  *
+ * the serial port and for <T> to the controllers. Emergency stops (speed -1) are never held.         *
+ *----------------------------------------------------------------------------------------------------*/
+typedef struct _coalesce
+{
+	long long lastSent;
+	int pending;
+	int len;
+	int frameLen;
+	char message[41];
+	char frame[DCC_FRAME_SIZE];
+}
+coalesceDef;
+
+typedef struct _trainCoalesce
+{
+	coalesceDef toSerial;
+	coalesceDef toClients;
+}
+trainCoalesceDef;
+
+trainCoalesceDef *trainCoalesce	=	NULL;
+int	 coalescePending			=	0;
+unsigned long coalescedCount	=	0;
+
+/*----------------------------------------------------------------------------------------------------*
+ * Messages for DCC++ are queued in lanes by priority, emergency stops and power off first, then      *
+ * control messages, then polls. They are written no faster than the link can send them, so there is  *
+ * never more than a few milliseconds of data waiting in the tty for an emergency stop to get behind. *
+ *----------------------------------------------------------------------------------------------------*/
+typedef struct _serialMsg
+{
+	long long queued;
+	int offset;
+	int len;
+	int done;
+}
+serialMsgDef;
+
+typedef struct _serialLane
+{
+	char *buffer;
+	int bufferUsed;
+	int bufferSize;
+	serialMsgDef *msgs;
+	int msgHead;
+	int msgCount;
+	int msgSize;
+	unsigned long sent;
+	unsigned long dropped;
+	long long totalWait;
+	long long worstWait;
+}
+serialLaneDef;
+
+serialLaneDef serialLanes[SERIAL_LANES];
+long long serialFreeAt			=	0;
+int	 serialPartial				=	-1;
+int	 serialBlocked				=	0;
+
+/*----------------------------------------------------------------------------------------------------*
+ * The serial port has a thread of its own, so reading DCC++ and pacing what we write to it is never  *
+ * held up by the network, and the other way round. Messages go each way through a ring with one      *
+ * writer and one reader, an eventfd wakes the reader. The serial thread only splits what it reads    *
+ * into messages, they are still handled on the main loop. Only the serial thread uses the lanes.     *
+ *----------------------------------------------------------------------------------------------------*/
+typedef struct _spscRing
+{
+	char *buffer;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+	unsigned long dropped;
+	int wakeFD;
+}
+spscRingDef;
+
+spscRingDef serialTxRing		=	{ NULL, 0, 0, 0, 0, -1 };
+spscRingDef serialRxRing		=	{ NULL, 0, 0, 0, 0, -1 };
+pthread_t serialThreadID;
+int	 serialFD					=	-1;
+int	 serialRunning				=	0;
+int	 serialTxWake				=	0;
+int	 serialPolls				=	0;
+int	 serialDumpStats			=	0;
 
 trackCtrlDef trackCtrl;
 
+void closeNetwork (int handle);
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P U T  L O G  M E S S A G E                                                                                       *
@@ -149,6 +310,9 @@ void sigHandler (int signo)
 	case SIGHUP:
 		putLogMessage (LOG_INFO, "Hangup signal received");
 		break;
+	case SIGUSR1:
+		dumpStats = 1;
+		break;
 	case SIGTERM:
 		putLogMessage (LOG_INFO, "Terminate signal received");
 		exit(0);
@@ -255,742 +419,2736 @@ int serialPortSetup (char *device)
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E N D  S E R I A L                                                                                              *
- *  ====================                                                                                              *
+ *  A L L O C  H A N D L E                                                                                            *
+ *  ======================                                                                                            *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send data to the serial port.
- *  \param buffer Data to send.
- *  \param len Size to send.
- *  \result The number of bytes sent.
+ *  \brief Get a free handle, reusing a closed one if there is one, otherwise growing the table.
+ *  \result Handle number, or -1 if we ran out of memory.
  */
-int sendSerial (char *buffer, int len)
+int allocHandle ()
 {
-	putLogMessage (LOG_DEBUG, "Sending -> Serial: %s[%d]", buffer, len);
-	return write (handleInfo[SERIAL_HANDLE].handle, buffer, len);
+	int handle = firstFree;
+
+	if (handle != -1)
+	{
+		firstFree = HINFO(handle).nextFree;
+	}
+	else
+	{
+		if (handleCount == slabCount * SLAB_HANDLES)
+		{
+			int i;
+			HANDLEINFO *newSlab;
+			HANDLEINFO **newSlabs = (HANDLEINFO **)realloc (handleSlabs, (slabCount + 1) * sizeof (HANDLEINFO *));
+
+			if (newSlabs == NULL)
+				return -1;
+			handleSlabs = newSlabs;
+			if ((newSlab = (HANDLEINFO *)malloc (SLAB_HANDLES * sizeof (HANDLEINFO))) == NULL)
+				return -1;
+			memset (newSlab, 0, SLAB_HANDLES * sizeof (HANDLEINFO));
+			for (i = 0; i < SLAB_HANDLES; ++i)
+				newSlab[i].handle = -1;
+			handleSlabs[slabCount++] = newSlab;
+		}
+		handle = handleCount++;
+	}
+	HINFO(handle).handle = -1;
+	HINFO(handle).handleType = 0;
+	HINFO(handle).nextFree = -1;
+	dccStreamInit (&HINFO(handle).rxedStream, RXED_BUFF_SIZE);
+	HINFO(handle).localName[0] = 0;
+	HINFO(handle).remoteName[0] = 0;
+	HINFO(handle).ringHead = HINFO(handle).ringLen = HINFO(handle).ringKeep = 0;
+	HINFO(handle).dropCount = 0;
+	HINFO(handle).frames = 0;
+	HINFO(handle).configPosn = 0;
+	return handle;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S T O P  A L L  T R A I N S                                                                                       *
- *  ===========================                                                                                       *
+ *  F R E E  H A N D L E                                                                                              *
+ *  ====================                                                                                              *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Stop all the trains, set throttles to -1, hard stop.
+ *  \brief Release a closed handle and its receive buffer, and put it on the free list.
+ *  \param handle Handle to release.
  *  \result None.
  */
-void stopAllTrains ()
+void freeHandle (int handle)
 {
-	int t;
-	char tempBuff[81];
-
-	if (trackCtrl.trainCtrl != NULL)
+	dccStreamFree (&HINFO(handle).rxedStream);
+	if (HINFO(handle).sendSegs != NULL)
 	{
-		for (t = 0; t < trackCtrl.trainCount; ++t)
-		{
-			trainCtrlDef *train = &trackCtrl.trainCtrl[t];
-			sprintf (tempBuff, "<t %d %d %d %d>", train -> trainReg, train -> trainID, -1, 0);
-			sendSerial (tempBuff, strlen (tempBuff));
-		}
-		usleep (100000);
+		free (HINFO(handle).sendSegs);
+		HINFO(handle).sendSegs = NULL;
+	}
+	if (HINFO(handle).ringBuff != NULL)
+	{
+		free (HINFO(handle).ringBuff);
+		HINFO(handle).ringBuff = NULL;
 	}
+	HINFO(handle).sendCount = HINFO(handle).sendSize = 0;
+	HINFO(handle).ringSize = HINFO(handle).ringHead = HINFO(handle).ringLen = HINFO(handle).ringKeep = 0;
+	HINFO(handle).handle = -1;
+	HINFO(handle).handleType = 0;
+	HINFO(handle).nextFree = firstFree;
+	firstFree = handle;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  T R A I N  U P D  F U N C T I O N                                                                                 *
- *  =================================                                                                                 *
+ *  A R E N A  A D D                                                                                                  *
+ *  ================                                                                                                  *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Update the function value.
- *  \param trainID Train to update.
- *  \param function Which function is being changed.
- *  \param state What is the new state.
- *  \result None.
+ *  \brief Copy a message into the send arena, growing it if needed.
+ *  \param buffer Message to add.
+ *  \param len Length of the message.
+ *  \result Offset of the message in the arena, -1 if we ran out of memory.
  */
-void trainUpdFunction (int trainID, int function, int state)
+int arenaAdd (char *buffer, int len)
 {
-	int t;
-	for (t = 0; t < trackCtrl.trainCount; ++t)
+	int offset = arenaUsed;
+
+	if (arenaUsed + len > arenaSize)
 	{
-		if (trackCtrl.trainCtrl[t].trainID == trainID && function >= 0 && function < 100)
+		int newSize = arenaSize ? arenaSize : ARENA_START;
+		char *newArena;
+
+		while (arenaUsed + len > newSize)
+			newSize *= 2;
+		if ((newArena = (char *)realloc (sendArena, newSize)) == NULL)
 		{
-			trackCtrl.trainCtrl[t].funcState[function] = state;
+			putLogMessage (LOG_ERR, "Out of memory for send arena: %d", newSize);
+			return -1;
 		}
+		sendArena = newArena;
+		arenaSize = newSize;
 	}
+	memcpy (&sendArena[offset], buffer, len);
+	arenaUsed += len;
+	return offset;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  G E T  A L L  P O I N T  S T A T E S                                                                              *
- *  ====================================                                                                              *
+ *  Q U E U E  S E G M E N T                                                                                          *
+ *  ========================                                                                                          *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Tell all the point controllers to output their state.
+ *  \brief Add part of the send arena to the list for a handle, merging it with the last part if they touch.
+ *  \param handle Internal handle to send to.
+ *  \param offset Offset in the arena.
+ *  \param len Length to send.
  *  \result None.
  */
-void getAllPointStates ()
+void queueSegment (int handle, int offset, int len)
 {
-	int p;
+	HANDLEINFO *info = &HINFO(handle);
 
-	if (trackCtrl.pointCtrl != NULL)
+	if (offset < 0 || info -> handle == -1)
+		return;
+
+	if (info -> sendCount > 0)
 	{
-		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		sendSegDef *last = &info -> sendSegs[info -> sendCount - 1];
+		if (last -> offset + last -> len == offset)
 		{
-			pointCtrlDef *point = &trackCtrl.pointCtrl[p];
-			if (point -> intHandle != -1)
-			{
-				if (handleInfo[point -> intHandle].handle != -1)
-				{
-					SendSocket (handleInfo[point -> intHandle].handle, "<Y>", 3);
-					SendSocket (handleInfo[point -> intHandle].handle, "<X>", 3);
-					SendSocket (handleInfo[point -> intHandle].handle, "<W>", 3);
-				}
-			}
+			last -> len += len;
+			return;
+		}
+	}
+	if (info -> sendCount == info -> sendSize)
+	{
+		int newSize = info -> sendSize ? info -> sendSize * 2 : 16;
+		sendSegDef *newSegs = (sendSegDef *)realloc (info -> sendSegs, newSize * sizeof (sendSegDef));
+
+		if (newSegs == NULL)
+		{
+			putLogMessage (LOG_ERR, "Out of memory for send queue: %d", handle);
+			return;
 		}
+		info -> sendSegs = newSegs;
+		info -> sendSize = newSize;
+	}
+	info -> sendSegs[info -> sendCount].offset = offset;
+	info -> sendSegs[info -> sendCount].len = len;
+	++info -> sendCount;
+
+	if (!info -> isDirty)
+	{
+		info -> isDirty = 1;
+		info -> nextDirty = firstDirty;
+		firstDirty = handle;
 	}
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E T  A L L  P O I N T  S T A T E S                                                                              *
- *  ====================================                                                                              *
+ *  Q U E U E  S E N D                                                                                                *
+ *  ==================                                                                                                *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send the current point states to the point server.
- *  \param pSvrIdent Server to sent to.
+ *  \brief Queue a message for one handle, it is sent when the send queues are flushed.
+ *  \param handle Internal handle to send to.
+ *  \param buffer Message to send.
+ *  \param len Length of the message.
  *  \result None.
  */
-void setAllPointStates (int pSvrIdent)
+void queueSend (int handle, char *buffer, int len)
 {
-	int p;
-	putLogMessage (LOG_DEBUG, "setAllPointStates: %d", pSvrIdent);
-	if (trackCtrl.pointCtrl != NULL)
-	{
-		pointCtrlDef *pointSever = NULL;
-
-		for (p = 0; p < trackCtrl.pServerCount; ++p)
-		{
-			if (trackCtrl.pointCtrl[p].ident == pSvrIdent)
-			{
-				pointSever = &trackCtrl.pointCtrl[p];
-				break;
-			}
-		}
-		if (pointSever)
-		{
-			if (pointSever -> intHandle != -1)
-			{
-				char tempBuff[80];
-				int i, cells = trackCtrl.trackLayout -> trackRows * trackCtrl.trackLayout -> trackCols;
-
-				for (i = 0; i < cells; ++i)
-				{
-					trackCellDef *cell = &trackCtrl.trackLayout -> trackCells[i];
-					if (cell -> point.point)
-					{
-						if (cell -> point.server == pSvrIdent)
-						{
-							sprintf (tempBuff, "<Y %d %d %d>", pSvrIdent, cell -> point.ident,
-									cell -> point.state == cell -> point.pointDef ? 0 : 1);
-							SendSocket (handleInfo[pointSever -> intHandle].handle, tempBuff, strlen (tempBuff));
-						}
-					}
-					if (cell -> signal.signal)
-					{
-						if (cell -> signal.server == pSvrIdent)
-						{
-							sprintf (tempBuff, "<X %d %d %d>", pSvrIdent, cell -> signal.ident,
-								cell -> signal.state == 2 ? 2 : 1);
-							SendSocket (handleInfo[pointSever -> intHandle].handle, tempBuff, strlen (tempBuff));
-						}
-
-					}
-				}
-			}
-		}
-	}
+	if (HINFO(handle).handle != -1)
+		queueSegment (handle, arenaAdd (buffer, len), len);
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S A V E  P O I N T  S T A T E                                                                                     *
- *  =============================                                                                                     *
+ *  M E S S A G E  L E N G T H                                                                                        *
+ *  ==========================                                                                                        *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Save the current state of the point as it is changed.
- *  \param pSvrIdent Server number.
- *  \param ident Point number.
- *  \param direc Point direction.
- *  \result None.
+ *  \brief Find the length of the text message or binary frame at a position in a buffer, the buffer may be a
+ *  ring. A frame is skipped by its length byte as its numbers can look like '<' or '>'.
+ *  \param buffer Buffer holding the messages.
+ *  \param size Size of the buffer, positions past the end go round to the start.
+ *  \param posn Where the message starts.
+ *  \param avail Bytes there are from the start of the message.
+ *  \result Length of the message, all the bytes available if it is not complete, 1 for a stray byte.
  */
-void savePointState (int pSvrIdent, int ident, int direc)
+int messageLength (char *buffer, int size, int posn, int avail)
 {
-	int i, cells = trackCtrl.trackLayout -> trackRows * trackCtrl.trackLayout -> trackCols;
+	int i;
+	char start = buffer[posn % size];
 
-	for (i = 0; i < cells; ++i)
+	if (start == DCC_FRAME_START)
 	{
-		trackCellDef *cell = &trackCtrl.trackLayout -> trackCells[i];
-		if (cell -> point.point)
-		{
-			if (cell -> point.server == pSvrIdent && cell -> point.ident == ident)
-			{
-				if (direc == 0)
-					cell -> point.state = cell -> point.pointDef;
-				else
-					cell -> point.state = cell -> point.point & ~(cell -> point.pointDef);
+		char header[2] = { start, avail > 1 ? buffer[(posn + 1) % size] : 0 };
+		int frameLen = dccFrameLength (header, avail);
 
-				break;
-			}
+		return frameLen == 0 ? avail : frameLen < 0 ? 1 : frameLen;
+	}
+	if (start == '<')
+	{
+		for (i = 1; i < avail; ++i)
+		{
+			if (buffer[(posn + i) % size] == '>')
+				return i + 1;
 		}
+		return avail;
 	}
+	return 1;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S A V E  S I G N A L  S T A T E                                                                                   *
- *  ===============================                                                                                   *
+ *  R I N G  D R O P                                                                                                  *
+ *  ================                                                                                                  *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Save the state of the signal.
- *  \param sSvrIdent Identity of the server.
- *  \param ident Identity of the signal.
- *  \param state New state of the signal.
- *  \result None.
+ *  \brief Make room in a full ring by dropping the oldest whole messages, a half sent message is kept.
+ *  \param info Handle to drop messages from.
+ *  \param len Space needed.
+ *  \result 1 if there is now room, 0 if dropping everything would not be enough.
  */
-void saveSignalState (int sSvrIdent, int ident, int state)
+int ringDrop (HANDLEINFO *info, int len)
 {
-	int i, cells = trackCtrl.trackLayout -> trackRows * trackCtrl.trackLayout -> trackCols;
+	int i, keep = info -> ringKeep, drop = 0, count = 0;
+
+#define RING_BYTE(n)	info -> ringBuff[(info -> ringHead + (n)) % info -> ringSize]
 
-	for (i = 0; i < cells; ++i)
+	/*------------------------------------------------------------------------------------------------*
+	 * The client has the start of the first message (ringKeep bytes are left), so it must still go.  *
+	 *------------------------------------------------------------------------------------------------*/
+	for (i = keep; i < info -> ringLen && info -> ringSize - info -> ringLen + drop < len; )
 	{
-		trackCellDef *cell = &trackCtrl.trackLayout -> trackCells[i];
-		if (cell -> signal.server == sSvrIdent && cell -> signal.ident == ident)
-		{
-			cell -> signal.state = state;
-			break;
-		}
+		i += messageLength (info -> ringBuff, info -> ringSize, info -> ringHead + i, info -> ringLen - i);
+		drop = i - keep;
+		++count;
 	}
+	if (info -> ringSize - info -> ringLen + drop < len)
+		return 0;
+
+	/*------------------------------------------------------------------------------------------------*
+	 * Move the kept bytes up to sit just in front of the first message we are keeping.               *
+	 *------------------------------------------------------------------------------------------------*/
+	for (i = keep - 1; i >= 0; --i)
+		RING_BYTE(i + drop) = RING_BYTE(i);
+
+#undef RING_BYTE
+
+	info -> ringHead = (info -> ringHead + drop) % info -> ringSize;
+	info -> ringLen -= drop;
+	info -> dropCount += count;
+	return 1;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E N D  P O I N T  S E R V E R                                                                                   *
- *  ===============================                                                                                   *
+ *  R I N G  A D D                                                                                                    *
+ *  ==============                                                                                                    *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send a message to the point server.
- *  \param pSvrIdent Point server identity.
- *  \param ident Identity of the point server.
- *  \param direc Direction for the point.
- *  \result None.
+ *  \brief Add to the queue of a client that is not keeping up, if it is full drop old messages or close it.
+ *  \param handle Internal handle to queue for.
+ *  \param buffer Data to add.
+ *  \param len Length of the data.
+ *  \result 1 if it was queued, 0 if the handle was closed.
  */
-void sendPointServer (int pSvrIdent, int ident, int direc)
+int ringAdd (int handle, char *buffer, int len)
 {
-	int p;
+	HANDLEINFO *info = &HINFO(handle);
+	int posn, part;
 
-	if (trackCtrl.pointCtrl != NULL)
+	if (info -> ringBuff == NULL)
 	{
-		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		info -> ringSize = trackCtrl.txQueueSize;
+		if ((info -> ringBuff = (char *)malloc (info -> ringSize)) == NULL)
 		{
-			pointCtrlDef *pointCtrl = &trackCtrl.pointCtrl[p];
-			if (pSvrIdent == pointCtrl -> ident)
-			{
-				if (pointCtrl -> intHandle != -1)
-				{
-					if (handleInfo[pointCtrl -> intHandle].handle != -1)
-					{
-						char tempBuff[81];
-						sprintf (tempBuff, "<Y %d %d %d>", pSvrIdent, ident, direc);
-						SendSocket (handleInfo[pointCtrl -> intHandle].handle,
-								tempBuff, strlen (tempBuff));
-						savePointState (pSvrIdent, ident, direc);
-					}
-				}
-				break;
-			}
+			putLogMessage (LOG_ERR, "Out of memory for client queue: %s(%d)", info -> localName, info -> handle);
+			closeNetwork (handle);
+			return 0;
+		}
+		info -> ringHead = info -> ringLen = info -> ringKeep = 0;
+	}
+	if (info -> ringSize - info -> ringLen < len)
+	{
+		/*--------------------------------------------------------------------------------------------*
+		 * Point servers need every message, so they are always closed, they get resent on connect.   *
+		 *--------------------------------------------------------------------------------------------*/
+		if (info -> handleType != CONTRL_HTYPE || trackCtrl.slowClient != SLOW_CLIENT_DROP ||
+				!ringDrop (info, len))
+		{
+			putLogMessage (LOG_ERR, "Client too slow, closing: %s(%d)", info -> localName, info -> handle);
+			closeNetwork (handle);
+			return 0;
 		}
 	}
+	posn = (info -> ringHead + info -> ringLen) % info -> ringSize;
+	part = info -> ringSize - posn;
+	if (part > len)
+		part = len;
+	memcpy (&info -> ringBuff[posn], buffer, part);
+	memcpy (info -> ringBuff, &buffer[part], len - part);
+	info -> ringLen += len;
+	return 1;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E N D  S I G N A L  S E R V E R                                                                                 *
- *  =================================                                                                                 *
+ *  R I N G  S E N D                                                                                                  *
+ *  ================                                                                                                  *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send the state of a signal.
- *  \param sSvrIdent Identity of the server.
- *  \param ident Identity of the signal.
- *  \param state State of the signal.
- *  \param type Is the a signal or a relay.
- *  \result None.
+ *  \brief Send as much of the queue for a slow client as it will now take.
+ *  \param handle Internal handle to send to.
+ *  \result 1 if the queue is empty, 0 if the client is still full, -1 on error.
  */
-void sendSignalServer (int sSvrIdent, int ident, int state, int type)
+int ringSend (int handle)
 {
-	int p;
+	HANDLEINFO *info = &HINFO(handle);
 
-	if (trackCtrl.pointCtrl != NULL)
+	while (info -> ringLen > 0)
 	{
-		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		struct iovec iov[2];
+		struct msghdr msg;
+		int sent, part = info -> ringSize - info -> ringHead;
+
+		if (part > info -> ringLen)
+			part = info -> ringLen;
+
+		memset (&msg, 0, sizeof (msg));
+		iov[0].iov_base = &info -> ringBuff[info -> ringHead];
+		iov[0].iov_len = part;
+		iov[1].iov_base = info -> ringBuff;
+		iov[1].iov_len = info -> ringLen - part;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+		if ((sent = sendmsg (info -> handle, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1)
 		{
-			pointCtrlDef *pointCtrl = &trackCtrl.pointCtrl[p];
-			if (sSvrIdent == pointCtrl -> ident)
-			{
-				if (pointCtrl -> intHandle != -1)
-				{
-					if (handleInfo[pointCtrl -> intHandle].handle != -1)
-					{
-						char tempBuff[81];
-						sprintf (tempBuff, "<%c %d %d %d>", type == 0 ? 'X' : 'W', sSvrIdent, ident, state);
-						SendSocket (handleInfo[pointCtrl -> intHandle].handle,
-								tempBuff, strlen (tempBuff));
-						saveSignalState (sSvrIdent, ident, state);
-					}
-				}
-				break;
-			}
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
 		}
+		/*--------------------------------------------------------------------------------------------*
+		 * Note how much of the last message the client has started but not had all of.               *
+		 *--------------------------------------------------------------------------------------------*/
+		while (info -> ringKeep < sent)
+			info -> ringKeep += messageLength (info -> ringBuff, info -> ringSize, info -> ringHead + info -> ringKeep,
+					info -> ringLen - info -> ringKeep);
+		info -> ringKeep -= sent;
+		info -> ringHead = (info -> ringHead + sent) % info -> ringSize;
+		info -> ringLen -= sent;
+	}
+	info -> ringHead = 0;
+	if (info -> dropCount)
+	{
+		putLogMessage (LOG_INFO, "Dropped %d messages for slow client: %s(%d)", info -> dropCount,
+				info -> localName, info -> handle);
+		info -> dropCount = 0;
 	}
+	return 1;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  C H E C K  S E R I A L  R E C V  B U F F E R                                                                      *
- *  ============================================                                                                      *
+ *  F L U S H  H A N D L E                                                                                            *
+ *  ======================                                                                                            *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Chech what we have received on the socket to see if we should update the display.
- *  \param buffer Buffer that was received.
- *  \param len Length of the buffer.
+ *  \brief Send everything queued for a handle without blocking, whatever it will not take goes on its queue.
+ *  \param handle Internal handle to flush.
  *  \result None.
  */
-void checkSerialRecvBuffer (char *buffer, int len)
+void flushHandle (int handle)
 {
-	char words[41][41];
-	int wordNum = -1, i = 0, j = 0, inType = 0;
+	struct iovec iov[MAX_IOV];
+	HANDLEINFO *info = &HINFO(handle);
+	int s = 0, corked = 0, blocked = info -> ringLen > 0;
 
-/*------------------------------------------------------------------*
-	printf ("Serial Rxed:[%s]\n", buffer);
- *------------------------------------------------------------------*/
-	while (i < len)
+	if (!blocked && info -> sendCount > MAX_IOV)
 	{
-		if (buffer[i] == '<' && wordNum == -1)
-		{
-			words[wordNum = 0][0] = 0;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= 'a' && buffer[i] <= 'z') || (buffer[i] >= 'A' && buffer[i] <= 'Z')))
-		{
-			if (inType == 2 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 1;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= '0' && buffer[i] <= '9') || buffer[i] == '-' || buffer[i] == '.'))
+		SetSocketCork (info -> handle, 1);
+		corked = 1;
+	}
+	while (s < info -> sendCount && !blocked)
+	{
+		struct msghdr msg;
+		int i, j, sent, total = 0, failed = 0;
+
+		memset (&msg, 0, sizeof (msg));
+		for (i = 0; i < MAX_IOV && s + i < info -> sendCount; ++i)
 		{
-			if (inType == 1 && j > 0)
-			{
-				words[++wordNum][0] = 0;
-				j = 0;
-			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 2;
+			iov[i].iov_base = &sendArena[info -> sendSegs[s + i].offset];
+			iov[i].iov_len = info -> sendSegs[s + i].len;
+			total += iov[i].iov_len;
 		}
-		else if (wordNum >= 0 && buffer[i] == '>')
-		{
-			if (j)
-				words[++wordNum][0] = 0;
+		msg.msg_iov = iov;
+		msg.msg_iovlen = i;
 
-			/* Track power status - power off stop trains */
-			if (words[0][0] == 'p' && wordNum >= 2)
+		while (total > 0)
+		{
+			if ((sent = sendmsg (info -> handle, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1)
 			{
-				int power = atoi (&words[1][0]);
-				if ((trackCtrl.powerState = power) == 0)
-					stopAllTrains ();
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					/*----------------------------------------------------------------------------*
+					 * The socket is broken, the read side will see it close, so drop the rest.   *
+					 *----------------------------------------------------------------------------*/
+					failed = 1;
+				}
+				break;
 			}
-			/* Throttle status */
-			else if (words[0][0] == 'T' && words[0][1] == 0 && wordNum == 4)
+			total -= sent;
+			while (sent > 0 && msg.msg_iovlen > 0)
 			{
-				int trainReg = atoi(words[1]), t;
-				for (t = 0; t < trackCtrl.trainCount; ++t)
+				if (sent >= msg.msg_iov[0].iov_len)
 				{
-					if (trackCtrl.trainCtrl != NULL)
-					{
-						if (trackCtrl.trainCtrl[t].trainReg == trainReg)
-						{
-							trackCtrl.trainCtrl[t].curSpeed = atoi(words[2]);
-							trackCtrl.trainCtrl[t].reverse = atoi(words[3]);
-						}
-					}
+					sent -= msg.msg_iov[0].iov_len;
+					++msg.msg_iov;
+					--msg.msg_iovlen;
+				}
+				else
+				{
+					msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + sent;
+					msg.msg_iov[0].iov_len -= sent;
+					sent = 0;
 				}
 			}
-			inType = 0;
-			wordNum = -1;
-			j = 0;
 		}
-		else if (wordNum >= 0 && j > 0 && (buffer[i] == ' ' || buffer[i] == '|'))
+		if (failed)
 		{
-			words[++wordNum][0] = 0;
-			j = 0;
+			s = info -> sendCount;
 		}
-		if (wordNum > 40)
+		else
 		{
-			words[wordNum = 40][0] = 0;
-			j = 0;
+			if (total > 0)
+			{
+				/*--------------------------------------------------------------------------------*
+				 * The client is full, queue the rest of this batch, later ones are queued below. *
+				 *--------------------------------------------------------------------------------*/
+				int keep = 0;
+				sendSegDef *seg = &info -> sendSegs[s + i - msg.msg_iovlen];
+				int done = (char *)msg.msg_iov[0].iov_base - &sendArena[seg -> offset];
+
+				/*--------------------------------------------------------------------------------*
+				 * Find how much of a half sent message is left so it is never dropped later.     *
+				 *--------------------------------------------------------------------------------*/
+				while (keep < done)
+					keep += messageLength (&sendArena[seg -> offset], seg -> len, keep, seg -> len - keep);
+
+				blocked = 1;
+				for (j = 0; j < msg.msg_iovlen && info -> handle != -1; ++j)
+				{
+					if (ringAdd (handle, (char *)msg.msg_iov[j].iov_base, msg.msg_iov[j].iov_len) && j == 0)
+						info -> ringKeep = keep - done;
+				}
+			}
+			s += i;
 		}
-		if (j > 40)
-			j = 40;
+	}
+	if (corked && info -> handle != -1)
+		SetSocketCork (info -> handle, 0);
+
+	for (; s < info -> sendCount && info -> handle != -1; ++s)
+		ringAdd (handle, &sendArena[info -> sendSegs[s].offset], info -> sendSegs[s].len);
+
+	info -> sendCount = 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F L U S H  S E N D  Q U E U E S                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Flush every handle that has something queued, then empty the arena.
+ *  \result None.
+ */
+void flushSendQueues ()
+{
+	while (firstDirty != -1)
+	{
+		int handle = firstDirty;
 
-		++i;
+		firstDirty = HINFO(handle).nextDirty;
+		HINFO(handle).isDirty = 0;
+		if (HINFO(handle).handle != -1 && HINFO(handle).sendCount > 0)
+			flushHandle (handle);
+
+		HINFO(handle).sendCount = 0;
 	}
+	arenaUsed = 0;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  C H E C K  N E T W O R K  R E C V  B U F F E R                                                                    *
+ *  S E N D  F O R M S  T O  C O N T R O L L E R S                                                                    *
  *  ==============================================                                                                    *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Check the buffer received from the network.
- *  \param handle Handle to send reply to.
- *  \param buffer Received buffer.
- *  \param len Size of data in the buffer.
- *  \result 1 if data was processed locally, 0 if it should be sent to serial.
+ *  \brief Queue a message for all the connected controllers, each form is only copied once. Controllers that have
+ *  asked for binary frames get the frame if there is one.
+ *  \param buffer Message to send as text.
+ *  \param len Length of the text.
+ *  \param frame Message as a binary frame, NULL if there is not one.
+ *  \param frameLen Length of the frame.
+ *  \result None.
  */
-int checkNetworkRecvBuffer (int handle, char *buffer, int len)
+void sendFormsToControllers (char *buffer, int len, char *frame, int frameLen)
 {
-	char words[41][41];
-	int retn = 0, wordNum = -1, i = 0, j = 0, inType = 0;
+	int h, offset = -1, frameOffset = -1;
 
-/*------------------------------------------------------------------*
-	putLogMessage (LOG_INFO, "Network Rxed:[%s]", buffer);
- *------------------------------------------------------------------*/
-	while (i < len)
+	for (h = FIRST_HANDLE; h < handleCount; ++h)
 	{
-		if (buffer[i] == '<' && wordNum == -1)
+		if (HINFO(h).handle != -1 && HINFO(h).handleType == CONTRL_HTYPE)
 		{
-			words[wordNum = 0][0] = 0;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= 'a' && buffer[i] <= 'z') || (buffer[i] >= 'A' && buffer[i] <= 'Z')))
-		{
-			if (inType == 2 && j > 0)
+			if (frame != NULL && HINFO(h).frames)
 			{
-				words[++wordNum][0] = 0;
-				j = 0;
+				if (frameOffset == -1 && (frameOffset = arenaAdd (frame, frameLen)) == -1)
+					break;
+				queueSegment (h, frameOffset, frameLen);
 			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 1;
-		}
-		else if (wordNum >= 0 && ((buffer[i] >= '0' && buffer[i] <= '9') || buffer[i] == '-' || buffer[i] == '.'))
-		{
-			if (inType == 1 && j > 0)
+			else
 			{
-				words[++wordNum][0] = 0;
-				j = 0;
+				if (offset == -1 && (offset = arenaAdd (buffer, len)) == -1)
+					break;
+				queueSegment (h, offset, len);
 			}
-			words[wordNum][j++] = buffer[i];
-			words[wordNum][j] = 0;
-			inType = 2;
 		}
-		else if (wordNum >= 0 && buffer[i] == '>')
-		{
-			if (j)
-				words[++wordNum][0] = 0;
+	}
+}
 
-			/* Set point state */
-			if (words[0][0] == 'Y' && words[0][1] == 0 && wordNum == 4)
-			{
-				int server = atoi (words[1]);
-				int ident = atoi (words[2]);
-				int direc = atoi (words[3]);
-				sendPointServer (server, ident, direc);
-				retn = 1;
-			}
-			/* Reply point server state */
-			else if (words[0][0] == 'y' && words[0][1] == 0 && wordNum == 4)
-			{
-				int h;
-				for (h = FIRST_HANDLE; h < MAX_HANDLES; ++h)
-				{
-					if (handleInfo[h].handle != -1 && handleInfo[h].handleType == CONTRL_HTYPE)
-						SendSocket (handleInfo[h].handle, buffer, len);
-				}
-				retn = 1;
-			}
-			/* Set signal state */
-			else if ((words[0][0] == 'X' || words[0][0] == 'W') && words[0][1] == 0 && wordNum == 4)
-			{
-				int server = atoi (words[1]);
-				int ident = atoi (words[2]);
-				int state = atoi (words[3]);
-				sendSignalServer (server, ident, state, words[0][0] == 'X' ? 0 : 1);
-				retn = 1;
-			}
-			/* Reply signal server state */
-			else if ((words[0][0] == 'x' || words[0][0] == 'w') && words[0][1] == 0 && wordNum == 4)
-			{
-				int h;
-				for (h = FIRST_HANDLE; h < MAX_HANDLES; ++h)
-				{
-					if (handleInfo[h].handle != -1 && handleInfo[h].handleType == CONTRL_HTYPE)
-						SendSocket (handleInfo[h].handle, buffer, len);
-				}
-				retn = 1;
-			}
-			/* Record and tell everyone about a function change */
-			else if (words[0][0] == 'F' && words[0][1] == 0 && wordNum == 4)
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  T O  C O N T R O L L E R S                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Queue a text message for all the connected controllers, it is only copied once.
+ *  \param buffer Message to send.
+ *  \param len Length of the message.
+ *  \result None.
+ */
+void sendToControllers (char *buffer, int len)
+{
+	sendFormsToControllers (buffer, len, NULL, 0);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  M E S S A G E  T O  C O N T R O L L E R S                                                                *
+ *  ==================================================                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Pass on a message that was received to all the connected controllers, as text or as a frame.
+ *  \param message Message to send.
+ *  \result None.
+ */
+void sendMessageToControllers (dccMessageDef *message)
+{
+	char textBuff[DCC_FORMAT_SIZE], frameBuff[DCC_FORMAT_SIZE];
+	int len, frameLen;
+	char *text = dccMessageForm (message, 0, textBuff, &len);
+	char *frame = dccMessageForm (message, 1, frameBuff, &frameLen);
+
+	sendFormsToControllers (text, len, frame == text ? NULL : frame, frameLen);
+}
+
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  Q U E U E  S T A T E                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Queue a point, signal or relay message for one handle, as a frame if it has asked for them.
+ *  \param handle Handle to send to.
+ *  \param opcode Opcode of the message.
+ *  \param server Identity of the point server.
+ *  \param ident Identity of the point, signal or relay.
+ *  \param state State to send.
+ *  \result None.
+ */
+void queueState (int handle, char opcode, int server, int ident, int state)
+{
+	char tempBuff[DCC_FORMAT_SIZE];
+	int values[3] = { server, ident, state };
+
+	queueSend (handle, tempBuff, dccFormat (tempBuff, HINFO(handle).frames, opcode, 3, values));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  G E T  U S  T I M E                                                                                               *
+ *  ===================                                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get a microsecond clock that is not changed when the time of day is set.
+ *  \result Microseconds.
+ */
+long long getUsTime ()
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  G E T  M S  T I M E                                                                                               *
+ *  ===================                                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get a millisecond clock that is not changed when the time of day is set.
+ *  \result Milliseconds.
+ */
+long long getMsTime ()
+{
+	return getUsTime () / 1000;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  I N I T                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Set up a ring to pass messages between two threads, with an eventfd to wake the reader.
+ *  \param ring Ring to set up.
+ *  \param size Size of the ring, must be a power of two.
+ *  \result 1 if it was set up.
+ */
+int spscInit (spscRingDef *ring, unsigned int size)
+{
+	ring -> head = ring -> tail = 0;
+	ring -> dropped = 0;
+	ring -> size = size;
+	if ((ring -> buffer = (char *)malloc (size)) == NULL)
+		return 0;
+
+	if ((ring -> wakeFD = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+	{
+		free (ring -> buffer);
+		ring -> buffer = NULL;
+		return 0;
+	}
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  F R E E                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Release a ring and its eventfd, only once both threads have finished with it.
+ *  \param ring Ring to free.
+ *  \result None.
+ */
+void spscFree (spscRingDef *ring)
+{
+	if (ring -> wakeFD != -1)
+	{
+		close (ring -> wakeFD);
+		ring -> wakeFD = -1;
+	}
+	if (ring -> buffer != NULL)
+	{
+		free (ring -> buffer);
+		ring -> buffer = NULL;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  C O P Y                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Copy in to or out of a ring, going round the end if needed.
+ *  \param ring Ring to copy with.
+ *  \param posn Position in the ring, it is wrapped here.
+ *  \param buffer Buffer to copy to or from.
+ *  \param len Bytes to copy.
+ *  \param toRing 1 to copy in to the ring, 0 to copy out.
+ *  \result None.
+ */
+static void spscCopy (spscRingDef *ring, unsigned int posn, char *buffer, int len, int toRing)
+{
+	unsigned int offset = posn & (ring -> size - 1);
+	int part = ring -> size - offset;
+
+	if (part > len)
+		part = len;
+
+	if (toRing)
+	{
+		memcpy (&ring -> buffer[offset], buffer, part);
+		memcpy (ring -> buffer, &buffer[part], len - part);
+	}
+	else
+	{
+		memcpy (buffer, &ring -> buffer[offset], part);
+		memcpy (&buffer[part], ring -> buffer, len - part);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  P U T                                                                                                    *
+ *  ==============                                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add a message to a ring, only ever called from the one thread that writes to it. The reader is not
+ *  woken here so a burst of messages only needs one wake.
+ *  \param ring Ring to add to.
+ *  \param tag Number passed with the message.
+ *  \param buffer Message to add.
+ *  \param len Length of the message, no more than RXED_BUFF_SIZE.
+ *  \result 1 if it was added, 0 if the ring is full.
+ */
+int spscPut (spscRingDef *ring, int tag, char *buffer, int len)
+{
+	int header[2] = { tag, len };
+	unsigned int head = ring -> head;
+	unsigned int tail = __atomic_load_n (&ring -> tail, __ATOMIC_ACQUIRE);
+
+	if (len > RXED_BUFF_SIZE || ring -> size - (head - tail) < sizeof (header) + len)
+	{
+		++ring -> dropped;
+		return 0;
+	}
+	spscCopy (ring, head, (char *)header, sizeof (header), 1);
+	spscCopy (ring, head + sizeof (header), buffer, len, 1);
+	__atomic_store_n (&ring -> head, head + sizeof (header) + len, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  G E T                                                                                                    *
+ *  ==============                                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Take the next message from a ring, only ever called from the one thread that reads it.
+ *  \param ring Ring to read.
+ *  \param tag Set to the number passed with the message.
+ *  \param buffer Where to copy the message, at least RXED_BUFF_SIZE bytes.
+ *  \result Length of the message, -1 if the ring is empty.
+ */
+int spscGet (spscRingDef *ring, int *tag, char *buffer)
+{
+	int header[2];
+	unsigned int tail = ring -> tail;
+	unsigned int head = __atomic_load_n (&ring -> head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return -1;
+
+	spscCopy (ring, tail, (char *)header, sizeof (header), 0);
+	spscCopy (ring, tail + sizeof (header), buffer, header[1], 0);
+	__atomic_store_n (&ring -> tail, tail + sizeof (header) + header[1], __ATOMIC_RELEASE);
+	*tag = header[0];
+	return header[1];
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  W A K E                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Wake the thread that reads a ring.
+ *  \param ring Ring that has had messages added.
+ *  \result None.
+ */
+void spscWake (spscRingDef *ring)
+{
+	uint64_t one = 1;
+
+	if (write (ring -> wakeFD, &one, sizeof (one)) == -1 && errno != EAGAIN)
+		putLogMessage (LOG_ERR, "Wake error: %s[%d]", strerror (errno), errno);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S P S C  W O K E N                                                                                                *
+ *  ==================                                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Clear the wake count, called by the reader before it empties the ring.
+ *  \param ring Ring that woke us.
+ *  \result None.
+ */
+void spscWoken (spscRingDef *ring)
+{
+	uint64_t count;
+
+	if (read (ring -> wakeFD, &count, sizeof (count)) == -1 && errno != EAGAIN)
+		putLogMessage (LOG_ERR, "Wake error: %s[%d]", strerror (errno), errno);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  Q U E U E                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add a message to the end of a serial lane, making room if needed.
+ *  \param lane Lane to add it to.
+ *  \param buffer Message to add.
+ *  \param len Length of the message.
+ *  \result 1 if it was queued, 0 if we ran out of memory.
+ */
+int serialQueue (serialLaneDef *lane, char *buffer, int len)
+{
+	/*------------------------------------------------------------------------------------------------*
+	 * Move anything still waiting to the start before growing the buffers.                           *
+	 *------------------------------------------------------------------------------------------------*/
+	if (lane -> msgHead > 0 && (lane -> bufferUsed + len > lane -> bufferSize || lane -> msgHead + lane -> msgCount ==
+			lane -> msgSize))
+	{
+		int i, start = lane -> msgs[lane -> msgHead].offset;
+
+		memmove (lane -> buffer, &lane -> buffer[start], lane -> bufferUsed - start);
+		lane -> bufferUsed -= start;
+		memmove (lane -> msgs, &lane -> msgs[lane -> msgHead], lane -> msgCount * sizeof (serialMsgDef));
+		lane -> msgHead = 0;
+		for (i = 0; i < lane -> msgCount; ++i)
+			lane -> msgs[i].offset -= start;
+	}
+	if (lane -> bufferUsed + len > lane -> bufferSize)
+	{
+		int newSize = lane -> bufferSize ? lane -> bufferSize : 1024;
+		char *newBuffer;
+
+		while (lane -> bufferUsed + len > newSize)
+			newSize *= 2;
+		if ((newBuffer = (char *)realloc (lane -> buffer, newSize)) == NULL)
+			return 0;
+		lane -> buffer = newBuffer;
+		lane -> bufferSize = newSize;
+	}
+	if (lane -> msgHead + lane -> msgCount == lane -> msgSize)
+	{
+		int newSize = lane -> msgSize ? lane -> msgSize * 2 : 32;
+		serialMsgDef *newMsgs = (serialMsgDef *)realloc (lane -> msgs, newSize * sizeof (serialMsgDef));
+
+		if (newMsgs == NULL)
+			return 0;
+		lane -> msgs = newMsgs;
+		lane -> msgSize = newSize;
+	}
+	memcpy (&lane -> buffer[lane -> bufferUsed], buffer, len);
+	lane -> msgs[lane -> msgHead + lane -> msgCount].queued = getUsTime ();
+	lane -> msgs[lane -> msgHead + lane -> msgCount].offset = lane -> bufferUsed;
+	lane -> msgs[lane -> msgHead + lane -> msgCount].len = len;
+	lane -> msgs[lane -> msgHead + lane -> msgCount].done = 0;
+	lane -> bufferUsed += len;
+	++lane -> msgCount;
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  D R O P  T H R O T T L E S                                                                           *
+ *  =======================================                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Drop throttle messages still waiting in the control lane, so a stop is not undone by an older speed
+ *  written after it. A message that is half written is left to finish, it goes before the stop anyway.
+ *  \param trainReg Register of the train, -1 for all of them.
+ *  \result Number of messages dropped.
+ */
+int serialDropThrottles (int trainReg)
+{
+	serialLaneDef *lane = &serialLanes[SERIAL_CONTROL];
+	int i, keep = 0, dropped = 0;
+
+	for (i = 0; i < lane -> msgCount; ++i)
+	{
+		serialMsgDef *msg = &lane -> msgs[lane -> msgHead + i];
+		char *text = &lane -> buffer[msg -> offset];
+		int reg;
+
+		if (msg -> done == 0 && msg -> len > 3 && strncmp (text, "<t ", 3) == 0 &&
+				sscanf (&text[3], "%d", &reg) == 1 && (trainReg == -1 || reg == trainReg))
+		{
+			++dropped;
+			continue;
+		}
+		lane -> msgs[lane -> msgHead + keep++] = *msg;
+	}
+	lane -> msgCount = keep;
+	if (keep == 0)
+		lane -> msgHead = lane -> bufferUsed = 0;
+
+	lane -> dropped += dropped;
+	return dropped;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  S E N D                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Write queued messages to DCC++, highest priority first, as fast as the link can take them. Only called
+ *  on the serial thread.
+ *  \result Milliseconds until more can be written, -1 if there is nothing to wait for.
+ */
+int serialSend ()
+{
+	while (serialFD != -1)
+	{
+		serialLaneDef *lane;
+		serialMsgDef *msg;
+		long long now = getUsTime ();
+		int l = serialPartial, sent;
+
+		/*--------------------------------------------------------------------------------------------*
+		 * A message that is half written must be finished first, or DCC++ gets a mix of both.       *
+		 *--------------------------------------------------------------------------------------------*/
+		if (l == -1)
+		{
+			for (l = 0; l < SERIAL_LANES && serialLanes[l].msgCount == 0; ++l)
+				;
+			if (l == SERIAL_LANES)
+				return -1;
+		}
+		if (serialFreeAt - now > SERIAL_AHEAD_US)
+			return (int)((serialFreeAt - now - SERIAL_AHEAD_US + 999) / 1000);
+
+		lane = &serialLanes[l];
+		msg = &lane -> msgs[lane -> msgHead];
+		if ((sent = write (serialFD, &lane -> buffer[msg -> offset + msg -> done], msg -> len - msg -> done)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				serialBlocked = 1;
+				return -1;
+			}
+
+			putLogMessage (LOG_ERR, "Serial write error: %s[%d]", strerror (errno), errno);
+			sent = msg -> len - msg -> done;
+		}
+		else
+		{
+			if (msg -> done == 0)
+			{
+				long long wait = now - msg -> queued;
+
+				++lane -> sent;
+				lane -> totalWait += wait;
+				if (wait > lane -> worstWait)
+					lane -> worstWait = wait;
+				putLogMessage (LOG_DEBUG, "Sending -> Serial: %.*s[%d] waited %lldus", msg -> len,
+						&lane -> buffer[msg -> offset], msg -> len, wait);
+			}
+			if (serialFreeAt < now)
+				serialFreeAt = now;
+			serialFreeAt += (long long)sent * 1000000 / SERIAL_BYTES_SEC;
+		}
+		if ((msg -> done += sent) < msg -> len)
+		{
+			serialPartial = l;
+			continue;
+		}
+		serialPartial = -1;
+		if (l == SERIAL_POLL)
+			__atomic_sub_fetch (&serialPolls, 1, __ATOMIC_RELEASE);
+		++lane -> msgHead;
+		if (--lane -> msgCount == 0)
+			lane -> msgHead = lane -> bufferUsed = 0;
+	}
+	return -1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O A L E S C E  D R O P  S E R I A L                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Forget the throttle messages being held for the serial port, for when all the trains are stopped.
+ *  \result None.
+ */
+void coalesceDropSerial ()
+{
+	int t;
+
+	if (trainCoalesce == NULL)
+		return;
+
+	for (t = 0; t < trackCtrl.trainCount; ++t)
+	{
+		if (trainCoalesce[t].toSerial.pending)
+		{
+			trainCoalesce[t].toSerial.pending = 0;
+			--coalescePending;
+			++coalescedCount;
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  S E R I A L                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Pass data to the serial thread, it is woken once the main loop has finished this pass. Power off and
+ *  emergency stop also drop any throttles being held, so they are not sent after it.
+ *  \param buffer Data to send.
+ *  \param len Size to send.
+ *  \param priority Which lane to send it in, SERIAL_URGENT, SERIAL_CONTROL or SERIAL_POLL.
+ *  \result The number of bytes queued.
+ */
+int sendSerial (char *buffer, int len, int priority)
+{
+	if (!serialRunning)
+		return -1;
+
+	if (priority == SERIAL_URGENT && len > 2 && (buffer[1] == '0' || buffer[1] == '!'))
+		coalesceDropSerial ();
+
+	if (!spscPut (&serialTxRing, priority, buffer, len))
+	{
+		putLogMessage (LOG_ERR, "Serial queue full: %d", priority);
+		return -1;
+	}
+	if (priority == SERIAL_POLL)
+		__atomic_add_fetch (&serialPolls, 1, __ATOMIC_RELEASE);
+
+	serialTxWake = 1;
+	return len;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  P R I O R I T Y                                                                                      *
+ *  ============================                                                                                      *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Work out which lane a message from a controller should go in.
+ *  \param message Message that was received.
+ *  \result Serial priority.
+ */
+int serialPriority (dccMessageDef *message)
+{
+	char opcode = 0;
+
+	/*------------------------------------------------------------------------------------------------*
+	 * An opcode that is not a letter or number (like <!>) is not a word, so take it from the text.   *
+	 *------------------------------------------------------------------------------------------------*/
+	if (message -> wordCount > 0)
+		opcode = message -> words[0].ptr[0];
+	else if (message -> msgLen > 2)
+		opcode = message -> msgStart[1];
+
+	switch (opcode)
+	{
+	case '0':
+	case '!':
+		return SERIAL_URGENT;
+
+	case 'c':
+	case 's':
+		return SERIAL_POLL;
+	}
+	return SERIAL_CONTROL;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C O A L E S C E  M E S S A G E                                                                                    *
+ *  ==============================                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Decide if a throttle message can go now or must be held until the end of the window.
+ *  \param coalesce Coalesce state for the train and direction.
+ *  \param buffer Message to send.
+ *  \param len Length of the message.
+ *  \param frame Message as a binary frame for controllers that want them, NULL if there is not one.
+ *  \param frameLen Length of the frame.
+ *  \param speed Speed in the message, -1 is an emergency stop.
+ *  \result 1 if it should be sent now, 0 if it is being held.
+ */
+int coalesceMessage (coalesceDef *coalesce, char *buffer, int len, char *frame, int frameLen, int speed)
+{
+	long long now = getMsTime ();
+
+	if (speed == -1 || len >= (int)sizeof (coalesce -> message) ||
+			(!coalesce -> pending && now >= coalesce -> lastSent + trackCtrl.coalesceTime))
+	{
+		if (coalesce -> pending)
+		{
+			coalesce -> pending = 0;
+			--coalescePending;
+			++coalescedCount;
+		}
+		coalesce -> lastSent = now;
+		return 1;
+	}
+	if (coalesce -> pending)
+		++coalescedCount;
+	else
+		++coalescePending;
+
+	memcpy (coalesce -> message, buffer, len);
+	coalesce -> len = len;
+	coalesce -> frameLen = 0;
+	if (frame != NULL && frameLen <= (int)sizeof (coalesce -> frame))
+	{
+		memcpy (coalesce -> frame, frame, frameLen);
+		coalesce -> frameLen = frameLen;
+	}
+	coalesce -> pending = 1;
+	return 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C H E C K  C O A L E S C E                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send any held throttle messages whose window has ended.
+ *  \result Milliseconds until the next one is due, or -1 if none are held.
+ */
+int checkCoalesce ()
+{
+	int t, waitTime = -1;
+	long long now;
+
+	if (coalescePending == 0 || trainCoalesce == NULL)
+		return -1;
+
+	now = getMsTime ();
+	for (t = 0; t < trackCtrl.trainCount; ++t)
+	{
+		coalesceDef *coalesce[2] = { &trainCoalesce[t].toSerial, &trainCoalesce[t].toClients };
+		int c;
+
+		for (c = 0; c < 2; ++c)
+		{
+			if (coalesce[c] -> pending)
+			{
+				long long due = coalesce[c] -> lastSent + trackCtrl.coalesceTime;
+
+				if (due <= now)
+				{
+					if (c == 0)
+						sendSerial (coalesce[c] -> message, coalesce[c] -> len, SERIAL_CONTROL);
+					else
+						sendFormsToControllers (coalesce[c] -> message, coalesce[c] -> len,
+								coalesce[c] -> frameLen ? coalesce[c] -> frame : NULL, coalesce[c] -> frameLen);
+					coalesce[c] -> pending = 0;
+					coalesce[c] -> lastSent = now;
+					--coalescePending;
+				}
+				else if (waitTime == -1 || due - now < waitTime)
+				{
+					waitTime = (int)(due - now);
+				}
+			}
+		}
+	}
+	return waitTime;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S T O P  A L L  T R A I N S                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Stop all the trains, set throttles to -1, hard stop.
+ *  \result None.
+ */
+void stopAllTrains ()
+{
+	int t;
+	char tempBuff[81];
+
+	if (trackCtrl.trainCtrl != NULL)
+	{
+		for (t = 0; t < trackCtrl.trainCount; ++t)
+		{
+			trainCtrlDef *train = &trackCtrl.trainCtrl[t];
+			sprintf (tempBuff, "<t %d %d %d %d>", train -> trainReg, train -> trainID, -1, 0);
+			if (trainCoalesce != NULL)
+				coalesceMessage (&trainCoalesce[t].toSerial, tempBuff, strlen (tempBuff), NULL, 0, -1);
+			sendSerial (tempBuff, strlen (tempBuff), SERIAL_URGENT);
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T R A I N  U P D  F U N C T I O N                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Update the function value.
+ *  \param trainID Train to update.
+ *  \param function Which function is being changed.
+ *  \param state What is the new state.
+ *  \result None.
+ */
+void trainUpdFunction (int trainID, int function, int state)
+{
+	trainCtrlDef *train = findTrainByID (&trackCtrl, trainID);
+
+	if (train != NULL && function >= 0 && function < FUNC_MAX)
+	{
+		FUNC_SET (train, function, state);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E T  A L L  P O I N T  S T A T E S                                                                              *
+ *  ====================================                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send the current point states to the point server.
+ *  \param pSvrIdent Server to sent to.
+ *  \result None.
+ */
+void setAllPointStates (int pSvrIdent)
+{
+	int p;
+	putLogMessage (LOG_DEBUG, "setAllPointStates: %d", pSvrIdent);
+	if (trackCtrl.pointCtrl != NULL)
+	{
+		pointCtrlDef *pointSever = NULL;
+
+		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		{
+			if (trackCtrl.pointCtrl[p].ident == pSvrIdent)
+			{
+				pointSever = &trackCtrl.pointCtrl[p];
+				break;
+			}
+		}
+		if (pointSever)
+		{
+			serverCellsDef *server = findServerCells (trackCtrl.trackLayout, pSvrIdent);
+
+			if (pointSever -> intHandle != -1 && server != NULL)
+			{
+				int i;
+
+				for (i = 0; i < server -> pointCount; ++i)
+				{
+					trackCellDef *cell = trackCtrl.trackLayout -> serverCellList[server -> firstPoint + i];
+
+					queueState (pointSever -> intHandle, 'Y', pSvrIdent, cell -> point.ident,
+							cell -> point.state == cell -> point.pointDef ? 0 : 1);
+				}
+				for (i = 0; i < server -> signalCount; ++i)
+				{
+					trackCellDef *cell = trackCtrl.trackLayout -> serverCellList[server -> firstSignal + i];
+
+					queueState (pointSever -> intHandle, 'X', pSvrIdent, cell -> signal.ident,
+						cell -> signal.state == 2 ? 2 : 1);
+				}
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S A V E  P O I N T  S T A T E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Save the current state of the point as it is changed.
+ *  \param pSvrIdent Server number.
+ *  \param ident Point number.
+ *  \param direc Point direction.
+ *  \result None.
+ */
+void savePointState (int pSvrIdent, int ident, int direc)
+{
+	trackCellDef *cell = findPointCell (trackCtrl.trackLayout, pSvrIdent, ident);
+
+	if (cell != NULL)
+	{
+		if (direc == 0)
+			cell -> point.state = cell -> point.pointDef;
+		else
+			cell -> point.state = cell -> point.point & ~(cell -> point.pointDef);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S A V E  S I G N A L  S T A T E                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Save the state of the signal.
+ *  \param sSvrIdent Identity of the server.
+ *  \param ident Identity of the signal.
+ *  \param state New state of the signal.
+ *  \result None.
+ */
+void saveSignalState (int sSvrIdent, int ident, int state)
+{
+	trackCellDef *cell = findSignalCell (trackCtrl.trackLayout, sSvrIdent, ident);
+
+	if (cell != NULL)
+		cell -> signal.state = state;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S A V E  R E L A Y  S T A T E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Save the state of the relay.
+ *  \param rSvrIdent Identity of the server.
+ *  \param ident Identity of the relay.
+ *  \param state New state of the relay.
+ *  \result None.
+ */
+void saveRelayState (int rSvrIdent, int ident, int state)
+{
+	int r;
+
+	for (r = 0; r < trackCtrl.relayCount; ++r)
+	{
+		if (trackCtrl.relays[r].server == rSvrIdent && trackCtrl.relays[r].ident == ident)
+			trackCtrl.relays[r].active = state;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  P O I N T  S E R V E R                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send a message to the point server.
+ *  \param pSvrIdent Point server identity.
+ *  \param ident Identity of the point server.
+ *  \param direc Direction for the point.
+ *  \result None.
+ */
+void sendPointServer (int pSvrIdent, int ident, int direc)
+{
+	int p;
+
+	if (trackCtrl.pointCtrl != NULL)
+	{
+		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		{
+			pointCtrlDef *pointCtrl = &trackCtrl.pointCtrl[p];
+			if (pSvrIdent == pointCtrl -> ident)
+			{
+				if (pointCtrl -> intHandle != -1)
+				{
+					if (HINFO(pointCtrl -> intHandle).handle != -1)
+					{
+						queueState (pointCtrl -> intHandle, 'Y', pSvrIdent, ident, direc);
+						savePointState (pSvrIdent, ident, direc);
+					}
+				}
+				break;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  S I G N A L  S E R V E R                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send the state of a signal.
+ *  \param sSvrIdent Identity of the server.
+ *  \param ident Identity of the signal.
+ *  \param state State of the signal.
+ *  \param type Is the a signal or a relay.
+ *  \result None.
+ */
+void sendSignalServer (int sSvrIdent, int ident, int state, int type)
+{
+	int p;
+
+	if (trackCtrl.pointCtrl != NULL)
+	{
+		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		{
+			pointCtrlDef *pointCtrl = &trackCtrl.pointCtrl[p];
+			if (sSvrIdent == pointCtrl -> ident)
+			{
+				if (pointCtrl -> intHandle != -1)
+				{
+					if (HINFO(pointCtrl -> intHandle).handle != -1)
+					{
+						queueState (pointCtrl -> intHandle, type == 0 ? 'X' : 'W', sSvrIdent, ident, state);
+						if (type == 0)
+							saveSignalState (sSvrIdent, ident, state);
+						else
+							saveRelayState (sSvrIdent, ident, state);
+					}
+				}
+				break;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  P O W E R  S T A T E                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Track power status from DCC++, power off stop trains.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void serialPowerState (dccMessageDef *message, int handle, void *userData)
+{
+	if ((trackCtrl.powerState = dccWordInt (message, 1)) == 0)
+		stopAllTrains ();
+
+	sendToControllers (message -> msgStart, message -> msgLen);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  T H R O T T L E  S T A T E                                                                           *
+ *  =======================================                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Throttle status from DCC++, save the current speed.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void serialThrottleState (dccMessageDef *message, int handle, void *userData)
+{
+	int speed = dccWordInt (message, 2), send = 1, frameLen;
+	trainCtrlDef *train = findTrainByReg (&trackCtrl, dccWordInt (message, 1));
+	char frameBuff[DCC_FORMAT_SIZE];
+	char *frame = dccMessageForm (message, 1, frameBuff, &frameLen);
+
+	if (frame == message -> msgStart)
+		frame = NULL;
+
+	if (train != NULL)
+	{
+		train -> curSpeed = speed;
+		train -> reverse = dccWordInt (message, 3);
+		if (trainCoalesce != NULL)
+			send = coalesceMessage (&trainCoalesce[train - trackCtrl.trainCtrl].toClients, message -> msgStart,
+					message -> msgLen, frame, frameLen, speed);
+	}
+	if (send)
+		sendFormsToControllers (message -> msgStart, message -> msgLen, frame, frameLen);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  P A S S  O N                                                                                         *
+ *  =========================                                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Anything else from DCC++ is just passed on to the controllers.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void serialPassOn (dccMessageDef *message, int handle, void *userData)
+{
+	sendToControllers (message -> msgStart, message -> msgLen);
+}
+
+dccCommandDef serialCommands[] =
+{
+	{	'p',	2,	-1,	serialPowerState	},
+	{	'T',	4,	4,	serialThrottleState	},
+	{	0,		0,	-1,	serialPassOn		}
+};
+dccDispatchDef serialDispatch;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  P O I N T  S T A T E                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Set point state, send it on to the point server.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkPointState (dccMessageDef *message, int handle, void *userData)
+{
+	sendPointServer (dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  S I G N A L  S T A T E                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Set signal or relay state, send it on to the point server.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkSignalState (dccMessageDef *message, int handle, void *userData)
+{
+	sendSignalServer (dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3),
+			message -> words[0].ptr[0] == 'X' ? 0 : 1);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  S E R V E R  S T A T E                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Reply from a point server with a point, signal or relay state, save it and tell the controllers.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkServerState (dccMessageDef *message, int handle, void *userData)
+{
+	int server = dccWordInt (message, 1), ident = dccWordInt (message, 2), state = dccWordInt (message, 3);
+
+	switch (message -> words[0].ptr[0])
+	{
+	case 'y':
+		savePointState (server, ident, state);
+		break;
+	case 'x':
+		saveSignalState (server, ident, state);
+		break;
+	case 'w':
+		saveRelayState (server, ident, state);
+		break;
+	}
+	sendMessageToControllers (message);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  F U N C T I O N  S T A T E                                                                         *
+ *  =========================================                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Record and tell everyone about a function change, then pass it on to DCC++.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkFunctionState (dccMessageDef *message, int handle, void *userData)
+{
+	int len;
+	char textBuff[DCC_FORMAT_SIZE];
+	char *text = dccMessageForm (message, 0, textBuff, &len);
+
+	trainUpdFunction (dccWordInt (message, 1), dccWordInt (message, 2), dccWordInt (message, 3));
+	sendMessageToControllers (message);
+	sendSerial (text, len, SERIAL_CONTROL);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  S T A T U S                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get socket status.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkStatus (dccMessageDef *message, int handle, void *userData)
+{
+	char buffer[101];
+	int h, conCounts[6] = { 0, 0, 0, 0, 0, 0 };
+
+	for (h = SERIAL_HANDLE; h < handleCount; ++h)
+	{
+		if (HINFO(h).handle != -1)
+		{
+			if (HINFO(h).handleType >= SERIAL_HTYPE && HINFO(h).handleType <= CONTRL_HTYPE)
+				++conCounts[HINFO(h).handleType - 1];
+		}
+	}
+	sprintf (buffer, "<V %d %d %d %d %d %d %d>", HINFO(handle).handle,
+			conCounts[0], conCounts[1], conCounts[2], conCounts[3], conCounts[4], conCounts[5]);
+	putLogMessage (LOG_INFO, "Status: %s", buffer);
+	queueSend (handle, buffer, strlen (buffer));
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  P O I N T  S E R V E R                                                                             *
+ *  =====================================                                                                             *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief A point server has told us who it is, send it the current states.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkPointServer (dccMessageDef *message, int handle, void *userData)
+{
+	if (HINFO(handle).handleType == POINTC_HTYPE)
+	{
+		int p;
+		for (p = 0; p < trackCtrl.pServerCount; ++p)
+		{
+			pointCtrlDef *point = &trackCtrl.pointCtrl[p];
+			if (point -> intHandle == handle)
 			{
-				int h;
-				int trainID = atoi (words[1]);
-				int function = atoi (words[2]);
-				int state = atoi (words[3]);
+				point -> ident = dccWordInt (message, 1);
+				dccWordCopy (message, message -> wordCount == 3 ? 2 : 1, point -> clientName, 41);
+				setAllPointStates (point -> ident);
+				queueSend (handle, "<W>", 3);
+				break;
+			}
+		}
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  T H R O T T L E                                                                                    *
+ *  ==============================                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief A controller has changed a throttle, only the newest speed in each window is sent to DCC++.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkThrottle (dccMessageDef *message, int handle, void *userData)
+{
+	int speed = dccWordInt (message, 3), send = 1, len;
+	trainCtrlDef *train = findTrainByReg (&trackCtrl, dccWordInt (message, 1));
+	char textBuff[DCC_FORMAT_SIZE];
+	char *text = dccMessageForm (message, 0, textBuff, &len);
+
+	if (train != NULL && trainCoalesce != NULL)
+	{
+		send = coalesceMessage (&trainCoalesce[train - trackCtrl.trainCtrl].toSerial, text, len, NULL, 0, speed);
+	}
+	if (send)
+		sendSerial (text, len, speed == -1 ? SERIAL_URGENT : SERIAL_CONTROL);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  F R A M E S                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief A controller or point server has asked for binary frames, reply with the version we will use. Anything
+ *  sent to it that has a frame form is sent that way from now on.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkFrames (dccMessageDef *message, int handle, void *userData)
+{
+	char tempBuff[DCC_FORMAT_SIZE];
+	int version = dccWordInt (message, 1);
+
+	if (version > DCC_FRAME_VERSION)
+		version = DCC_FRAME_VERSION;
+	if (version < 0)
+		version = 0;
+
+	queueSend (handle, tempBuff, dccFormat (tempBuff, 0, DCC_FRAME_OPCODE, 1, &version));
+	HINFO(handle).frames = version;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  N E T W O R K  P A S S  O N                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Anything we do not handle locally is for DCC++, which only understands text.
+ *  \param message Message that was received.
+ *  \param handle Internal handle it was received on.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void networkPassOn (dccMessageDef *message, int handle, void *userData)
+{
+	int len;
+	char textBuff[DCC_FORMAT_SIZE];
+	char *text = dccMessageForm (message, 0, textBuff, &len);
+
+	sendSerial (text, len, serialPriority (message));
+}
+
+dccCommandDef networkCommands[] =
+{
+	{	'Y',	4,	4,	networkPointState		},
+	{	'y',	4,	4,	networkServerState		},
+	{	'X',	4,	4,	networkSignalState		},
+	{	'W',	4,	4,	networkSignalState		},
+	{	'x',	4,	4,	networkServerState		},
+	{	'w',	4,	4,	networkServerState		},
+	{	'F',	4,	4,	networkFunctionState	},
+	{	'V',	1,	1,	networkStatus			},
+	{	'P',	2,	3,	networkPointServer		},
+	{	't',	5,	5,	networkThrottle			},
+	{	'K',	2,	2,	networkFrames			},
+	{	0,		0,	-1,	networkPassOn			}
+};
+dccDispatchDef networkDispatch;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D U M P  D I S P A T C H  S T A T S                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Log how many messages of each opcode were handled here and how many were passed on.
+ *  \param name Name of the dispatcher.
+ *  \param dispatch Dispatcher to log.
+ *  \result None.
+ */
+void dumpDispatchStats (char *name, dccDispatchDef *dispatch)
+{
+	int op;
+	unsigned long totalHandled = 0, totalPassedOn = 0;
+
+	for (op = 0; op < 256; ++op)
+	{
+		if (dispatch -> handled[op] || dispatch -> passedOn[op])
+		{
+			putLogMessage (LOG_INFO, "%s <%c>: handled %lu, passed on %lu", name, op >= ' ' && op < 127 ? op : '?',
+					dispatch -> handled[op], dispatch -> passedOn[op]);
+			totalHandled += dispatch -> handled[op];
+			totalPassedOn += dispatch -> passedOn[op];
+		}
+	}
+	putLogMessage (LOG_INFO, "%s total: handled %lu, passed on %lu", name, totalHandled, totalPassedOn);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D U M P  S E R I A L  S T A T S                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Log how many messages went in each serial lane and how long they waited, on the serial thread.
+ *  \result None.
+ */
+void dumpSerialStats ()
+{
+	static char *laneNames[SERIAL_LANES] = { "urgent", "control", "poll" };
+	int l;
+
+	for (l = 0; l < SERIAL_LANES; ++l)
+	{
+		serialLaneDef *lane = &serialLanes[l];
+
+		putLogMessage (LOG_INFO, "Serial %s: sent %lu, dropped %lu, queued %d, wait average %lldus, worst %lldus",
+				laneNames[l], lane -> sent, lane -> dropped, lane -> msgCount,
+				lane -> sent ? lane -> totalWait / (long long)lane -> sent : 0LL, lane -> worstWait);
+	}
+}
 
-				trainUpdFunction (trainID, function, state);
-				for (h = FIRST_HANDLE; h < MAX_HANDLES; ++h)
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  L O A D  C O N F I G  F I L E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read the config file from disk and keep it in memory.
+ *  \result True if it was read and parsed.
+ */
+int loadConfigFile ()
+{
+	int retn = 0;
+	struct stat statbuf;
+
+	if (stat (xmlConfigFile, &statbuf) == 0)
+	{
+		FILE *inFile = fopen (xmlConfigFile, "r");
+		if (inFile != NULL)
+		{
+			xmlBufferSize = statbuf.st_size;
+			if ((xmlBuffer = (char *)malloc (xmlBufferSize + 10)) != NULL)
+			{
+				if (fread (xmlBuffer, 1, xmlBufferSize, inFile) == xmlBufferSize)
 				{
-					if (handleInfo[h].handle != -1 && handleInfo[h].handleType == CONTRL_HTYPE)
-						SendSocket (handleInfo[h].handle, buffer, len);
+					retn = parseMemoryXML (&trackCtrl, xmlBuffer);
 				}
-				retn = 0;
 			}
-			/* Get socket status */
-			else if (words[0][0] == 'V' && words[0][1] == 0 && wordNum == 1)
+			fclose (inFile);
+		}
+	}
+	return retn;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  A L L  F U N C T I O N S                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send the functions that are on for all the trains in as few messages as we can. Each <G> message has
+ *  the train then each word of the function bitset in decimal, lowest first, trains with no functions on are left
+ *  out. The words are signed so the parser reads them as whole numbers.
+ *  \param handle Internal handle to send to.
+ *  \result None.
+ */
+void sendAllFunctions (int handle)
+{
+	int t, w, len = 0, pairs = 0;
+	char tempBuff[(FUNC_FRAME_TRAINS * 72) + 10];
+
+	if (trackCtrl.trainCtrl != NULL)
+	{
+		for (t = 0; t < trackCtrl.trainCount; ++t)
+		{
+			trainCtrlDef *train = &trackCtrl.trainCtrl[t];
+
+			for (w = 0; w < FUNC_WORDS && train -> funcState[w] == 0; ++w)
+				;
+			if (w == FUNC_WORDS)
+				continue;
+
+			if (pairs == 0)
+				len = sprintf (tempBuff, "<G");
+			len += sprintf (&tempBuff[len], " %d", train -> trainID);
+			for (w = 0; w < FUNC_WORDS; ++w)
+				len += sprintf (&tempBuff[len], " %d", (int)train -> funcState[w]);
+
+			if (++pairs == FUNC_FRAME_TRAINS)
 			{
-				char buffer[101];
-				int h, conCounts[6] = { 0, 0, 0, 0, 0, 0 };
+				len += sprintf (&tempBuff[len], ">");
+				queueSend (handle, tempBuff, len);
+				pairs = 0;
+			}
+		}
+		if (pairs)
+		{
+			len += sprintf (&tempBuff[len], ">");
+			queueSend (handle, tempBuff, len);
+		}
+	}
+}
 
-				for (h = SERIAL_HANDLE; h < MAX_HANDLES; ++h)
-				{
-					if (handleInfo[h].handle != -1)
-					{
-						if (handleInfo[h].handleType >= SERIAL_HTYPE && handleInfo[h].handleType <= CONTRL_HTYPE)
-							++conCounts[handleInfo[h].handleType - 1];
-					}
-				}
-				sprintf (buffer, "<V %d %d %d %d %d %d %d>", handleInfo[handle].handle,
-						conCounts[0], conCounts[1], conCounts[2], conCounts[3], conCounts[4], conCounts[5]);
-				putLogMessage (LOG_INFO, "Status: %s", buffer);
-				SendSocket (handleInfo[handle].handle, buffer, strlen (buffer));
-				retn = 1;
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S N A P S H O T  A D D                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add a message to the snapshot buffer, sending the buffer on when it gets full.
+ *  \param handle Internal handle to send to.
+ *  \param buffer Snapshot buffer, SNAPSHOT_SIZE long.
+ *  \param len Bytes in the buffer, updated.
+ *  \param message Message to add.
+ *  \result None.
+ */
+void snapshotAdd (int handle, char *buffer, int *len, char *message)
+{
+	int msgLen = strlen (message);
+
+	if (*len + msgLen > SNAPSHOT_SIZE)
+	{
+		queueSend (handle, buffer, *len);
+		*len = 0;
+	}
+	memcpy (&buffer[*len], message, msgLen);
+	*len += msgLen;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  S N A P S H O T                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send a new controller everything we know, power, speeds, points, signals, relays and functions, so
+ *  there is no need to ask DCC++ or the point servers again.
+ *  \param handle Internal handle to send to.
+ *  \result None.
+ */
+void sendSnapshot (int handle)
+{
+	int t, s, i, len = 0;
+	char buffer[SNAPSHOT_SIZE], tempBuff[81];
+
+	if (trackCtrl.powerState != POWER_SRT)
+	{
+		sprintf (tempBuff, "<p%d>", trackCtrl.powerState);
+		snapshotAdd (handle, buffer, &len, tempBuff);
+	}
+	for (t = 0; t < trackCtrl.trainCount; ++t)
+	{
+		trainCtrlDef *train = &trackCtrl.trainCtrl[t];
+
+		sprintf (tempBuff, "<T %d %d %d>", train -> trainReg, train -> curSpeed, train -> reverse);
+		snapshotAdd (handle, buffer, &len, tempBuff);
+	}
+	if (trackCtrl.trackLayout != NULL && trackCtrl.trackLayout -> serverCells != NULL)
+	{
+		for (s = 0; s < trackCtrl.trackLayout -> serverCount; ++s)
+		{
+			serverCellsDef *server = &trackCtrl.trackLayout -> serverCells[s];
+
+			for (i = 0; i < server -> pointCount; ++i)
+			{
+				trackCellDef *cell = trackCtrl.trackLayout -> serverCellList[server -> firstPoint + i];
+
+				sprintf (tempBuff, "<y %d %d %d>", server -> server, cell -> point.ident,
+						cell -> point.state == cell -> point.pointDef ? 0 : 1);
+				snapshotAdd (handle, buffer, &len, tempBuff);
+			}
+			for (i = 0; i < server -> signalCount; ++i)
+			{
+				trackCellDef *cell = trackCtrl.trackLayout -> serverCellList[server -> firstSignal + i];
+
+				sprintf (tempBuff, "<x %d %d %d>", server -> server, cell -> signal.ident, cell -> signal.state);
+				snapshotAdd (handle, buffer, &len, tempBuff);
 			}
-			else if (words[0][0] == 'P' && words[0][1] == 0 && (wordNum == 2 || wordNum == 3))
+		}
+	}
+	for (i = 0; i < trackCtrl.relayCount; ++i)
+	{
+		sprintf (tempBuff, "<w %d %d %d>", trackCtrl.relays[i].server, trackCtrl.relays[i].ident,
+				trackCtrl.relays[i].active);
+		snapshotAdd (handle, buffer, &len, tempBuff);
+	}
+	if (len)
+		queueSend (handle, buffer, len);
+
+	sendAllFunctions (handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  E P O L L  A D D  H A N D L E                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Register a handle with epoll, edge triggered, so it is only looked at when it has work.
+ *  \param handle Internal handle to add.
+ *  \param events Events to wait for.
+ *  \result 1 if it was added.
+ */
+int epollAddHandle (int handle, int events)
+{
+	struct epoll_event event;
+
+	memset (&event, 0, sizeof (event));
+	event.events = events | EPOLLET;
+	event.data.u32 = handle;
+	if (epoll_ctl (epollFD, EPOLL_CTL_ADD, HINFO(handle).handle, &event) == -1)
+	{
+		putLogMessage (LOG_ERR, "Epoll add error: %s[%d]", strerror (errno), errno);
+		return 0;
+	}
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  E P O L L  R E A R M  H A N D L E                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Register for the events on a handle again, epoll reports it once more if it is still ready.
+ *  \param handle Internal handle to re-arm.
+ *  \param events Events to wait for.
+ *  \result 1 if it was re-armed.
+ */
+int epollRearmHandle (int handle, int events)
+{
+	struct epoll_event event;
+
+	memset (&event, 0, sizeof (event));
+	event.events = events | EPOLLET;
+	event.data.u32 = handle;
+	if (epoll_ctl (epollFD, EPOLL_CTL_MOD, HINFO(handle).handle, &event) == -1)
+	{
+		putLogMessage (LOG_ERR, "Epoll modify error: %s[%d]", strerror (errno), errno);
+		return 0;
+	}
+	return 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C L O S E  H A N D L E                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Remove a handle from epoll and close it.
+ *  \param handle Internal handle to close.
+ *  \result None.
+ */
+void closeHandle (int handle)
+{
+	if (HINFO(handle).handle != -1)
+	{
+		epoll_ctl (epollFD, EPOLL_CTL_DEL, HINFO(handle).handle, NULL);
+		CloseSocket (&HINFO(handle).handle);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A C C E P T  N E X T                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Accept the next connection on a listening handle. Errors that only affect the one connection are
+ *  skipped, if we are out of files the accept is tried again later as epoll will not report it again.
+ *  \param handle Internal handle of the listening socket.
+ *  \param address Save remote address here.
+ *  \result Handle of new socket, or -1 if there is nothing more to accept for now.
+ */
+int acceptNext (int handle, char *address)
+{
+	int newSocket;
+
+	while ((newSocket = AcceptSocket (HINFO(handle).handle, address)) == -1)
+	{
+		if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+			continue;
+
+		if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+		{
+			if (acceptRetryAt == 0)
+				putLogMessage (LOG_ERR, "Accept error, will retry: %s[%d]", strerror (errno), errno);
+			acceptRetryAt = getMsTime () + ACCEPT_BACKOFF;
+		}
+		else if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			putLogMessage (LOG_ERR, "Accept error: %s[%d]", strerror (errno), errno);
+		}
+		break;
+	}
+	return newSocket;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A C C E P T  C O N T R O L L E R                                                                                  *
+ *  ================================                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Accept all the waiting controller connections.
+ *  \result None.
+ */
+void acceptController ()
+{
+	char inAddress[50] = "", outBuffer[41];
+	int i, newSocket;
+
+	while ((newSocket = acceptNext (LISTEN_HANDLE, inAddress)) != -1)
+	{
+		if ((i = allocHandle ()) == -1)
+		{
+			putLogMessage (LOG_ERR, "No free handles.");
+			CloseSocket (&newSocket);
+			continue;
+		}
+		HINFO(i).handle = newSocket;
+		HINFO(i).handleType = CONTRL_HTYPE;
+		setNonBlocking (newSocket, 1);
+		SetSocketNoDelay (newSocket, 1);
+		strncpy (HINFO(i).localName, inAddress, 50);
+		if (!epollAddHandle (i, EPOLLIN | EPOLLOUT))
+		{
+			CloseSocket (&HINFO(i).handle);
+			freeHandle (i);
+			continue;
+		}
+		putLogMessage (LOG_INFO, "Socket opened: %s(%d)", HINFO(i).localName, HINFO(i).handle);
+		sprintf (outBuffer, "<V %d>", HINFO(i).handle);
+		queueSend (i, outBuffer, strlen (outBuffer));
+		/*--------------------------------------------------------------------------------------------*
+		 * Only ask DCC++ for its state until it has told us the power state, after that we know.     *
+		 *--------------------------------------------------------------------------------------------*/
+		if (trackCtrl.powerState == POWER_SRT)
+			sendSerial ("<s>", 3, SERIAL_POLL);
+		sendSnapshot (i);
+		++connectedCount;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A C C E P T  P O I N T  S E R V E R                                                                               *
+ *  ===================================                                                                               *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Accept all the waiting point server connections.
+ *  \result None.
+ */
+void acceptPointServer ()
+{
+	char inAddress[50] = "";
+	int i, p, newSocket;
+
+	while ((newSocket = acceptNext (POINTL_HANDLE, inAddress)) != -1)
+	{
+		int done = 0;
+
+		if (trackCtrl.pointCtrl != NULL)
+		{
+			for (p = 0; p < trackCtrl.pServerCount && !done; ++p)
 			{
-				if (handleInfo[handle].handleType == POINTC_HTYPE)
+				if (trackCtrl.pointCtrl[p].intHandle == -1)
 				{
-					int p;
-					for (p = 0; p < trackCtrl.pServerCount; ++p)
+					if ((i = allocHandle ()) == -1)
 					{
-						pointCtrlDef *point = &trackCtrl.pointCtrl[p];
-						if (point -> intHandle == handle)
-						{
-							point -> ident = atoi (words[1]);
-							strncpy (point -> clientName, wordNum == 3 ? words[2] : words[1], 41);
-							setAllPointStates (point -> ident);
-							break;
-						}
+						putLogMessage (LOG_ERR, "No free handles: %s(%d).", inAddress, newSocket);
+						break;
+					}
+					HINFO(i).handle = newSocket;
+					HINFO(i).handleType = POINTC_HTYPE;
+					setNonBlocking (newSocket, 1);
+					SetSocketNoDelay (newSocket, 1);
+					strncpy (HINFO(i).localName, inAddress, 50);
+					if (!epollAddHandle (i, EPOLLIN | EPOLLOUT))
+					{
+						HINFO(i).handle = -1;
+						freeHandle (i);
+						break;
 					}
+					trackCtrl.pointCtrl[p].intHandle = i;
+					putLogMessage (LOG_INFO, "Socket opened: %s(%d)", HINFO(i).localName, HINFO(i).handle);
+					done = 1;
 				}
-				retn = 1;
 			}
-			inType = 0;
-			wordNum = -1;
-			j = 0;
+			if (!done && p == trackCtrl.pServerCount)
+				putLogMessage (LOG_INFO, "All point servers are already conneted: %s(%d).", inAddress, newSocket);
+		}
+		else
+		{
+			putLogMessage (LOG_INFO, "No point control configured.");
+		}
+		if (!done)
+			CloseSocket (&newSocket);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E N D  C O N F I G  P A R T                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send as much of the config file as the socket will take, close it when it has all gone.
+ *  \param handle Internal handle of the config request.
+ *  \result None.
+ */
+void sendConfigPart (int handle)
+{
+	HANDLEINFO *info = &HINFO(handle);
+	int sent;
+
+	while (info -> configPosn < xmlBufferSize && xmlBuffer != NULL)
+	{
+		if ((sent = send (info -> handle, &xmlBuffer[info -> configPosn], xmlBufferSize - info -> configPosn,
+				MSG_NOSIGNAL | MSG_DONTWAIT)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			break;
 		}
-		else if (wordNum >= 0 && j > 0 && (buffer[i] == ' ' || buffer[i] == '|'))
+		info -> configPosn += sent;
+	}
+	closeHandle (handle);
+	freeHandle (handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A C C E P T  C O N F I G                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Accept all the waiting config requests, the config is sent as they can take it, then they are closed.
+ *  \result None.
+ */
+void acceptConfig ()
+{
+	char inAddress[50] = "";
+	int i, newSocket;
+
+	while ((newSocket = acceptNext (CONFIG_HANDLE, inAddress)) != -1)
+	{
+		if ((i = allocHandle ()) == -1)
 		{
-			words[++wordNum][0] = 0;
-			j = 0;
+			putLogMessage (LOG_ERR, "No free handles.");
+			CloseSocket (&newSocket);
+			continue;
 		}
-		if (wordNum > 40)
+		HINFO(i).handle = newSocket;
+		HINFO(i).handleType = CONFGC_HTYPE;
+		setNonBlocking (newSocket, 1);
+		strncpy (HINFO(i).localName, inAddress, 50);
+		if (!epollAddHandle (i, EPOLLOUT))
 		{
-			words[wordNum = 40][0] = 0;
-			j = 0;
+			CloseSocket (&HINFO(i).handle);
+			freeHandle (i);
+			continue;
 		}
-		if (j > 40)
-			j = 40;
+		sendConfigPart (i);
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S E R I A L  S P L I T                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Every complete message read on the serial thread is passed to the main loop to be handled.
+ *  \param message Message that was received.
+ *  \param handle Not used.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void serialSplit (dccMessageDef *message, int handle, void *userData)
+{
+	if (!spscPut (&serialRxRing, 0, message -> msgStart, message -> msgLen))
+		putLogMessage (LOG_ERR, "Serial receive queue full");
+}
+
+dccCommandDef serialSplitCommands[] =
+{
+	{	0,		0,	-1,	serialSplit			}
+};
+dccDispatchDef serialSplitDispatch;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  R E A D  S E R I A L                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Read everything waiting on the serial port and pass on the complete messages, on the serial thread.
+ *  \param rxedStream Stream that keeps any incomplete message.
+ *  \result None.
+ */
+void readSerial (dccStreamDef *rxedStream)
+{
+	int readBytes;
+	char buffer[10241];
+	unsigned int head = serialRxRing.head;
 
-		++i;
+	while ((readBytes = read (serialFD, buffer, 10240)) > 0)
+	{
+		buffer[readBytes] = 0;
+		putLogMessage (LOG_DEBUG, "Received <- Serial: %s[%d]", buffer, readBytes);
+		dccParseStream (rxedStream, &serialSplitDispatch, buffer, readBytes, SERIAL_HANDLE, NULL);
 	}
-	return retn;
+	if (serialRxRing.head != head)
+		spscWake (&serialRxRing);
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  R E C E I V E  S E R I A L                                                                                        *
- *  ==========================                                                                                        *
+ *  S E R I A L  T A K E  Q U E U E                                                                                   *
+ *  ===============================                                                                                   *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Keep buffering until we get a closing '>' and the send to all.
- *  \param handle Internal handle of the serial port.
- *  \param buffer Received buffer.
- *  \param len Buffer length.
+ *  \brief Move everything the main loop has sent into the serial lanes, on the serial thread.
  *  \result None.
  */
-void receiveSerial (int handle, char *buffer, int len)
+void serialTakeQueue ()
 {
-	int h, j = 0;
+	int len, priority;
+	char buffer[RXED_BUFF_SIZE + 1];
 
-	while (j < len)
+	while ((len = spscGet (&serialTxRing, &priority, buffer)) >= 0)
 	{
-		handleInfo[handle].rxedBuff[handleInfo[handle].rxedPosn++] = buffer[j];
-		if (buffer[j] == '>')
+		/*--------------------------------------------------------------------------------------------*
+		 * Emergency stops and power off overtake the control lane, so drop the throttles they beat.  *
+		 *--------------------------------------------------------------------------------------------*/
+		if (priority == SERIAL_URGENT && len > 2)
 		{
-			handleInfo[handle].rxedBuff[handleInfo[handle].rxedPosn] = 0;
-			checkSerialRecvBuffer (handleInfo[handle].rxedBuff, handleInfo[handle].rxedPosn);
-			for (h = FIRST_HANDLE; h < MAX_HANDLES; ++h)
-			{
-				if (handleInfo[h].handle != -1 && handleInfo[h].handleType == CONTRL_HTYPE)
-					SendSocket (handleInfo[h].handle, handleInfo[handle].rxedBuff, handleInfo[handle].rxedPosn);
-			}
-			handleInfo[handle].rxedPosn = 0;
+			int reg, cab, speed;
+
+			buffer[len] = 0;
+			if (buffer[1] == '0' || buffer[1] == '!')
+				serialDropThrottles (-1);
+			else if (sscanf (buffer, "<t %d %d %d", &reg, &cab, &speed) == 3 && speed == -1)
+				serialDropThrottles (reg);
 		}
-		if (handleInfo[handle].rxedPosn >= RXED_BUFF_SIZE)
+		if (!serialQueue (&serialLanes[priority], buffer, len))
 		{
-			handleInfo[handle].rxedPosn = 0;
-			break;
+			putLogMessage (LOG_ERR, "Out of memory for serial queue: %d", priority);
+			if (priority == SERIAL_POLL)
+				__atomic_sub_fetch (&serialPolls, 1, __ATOMIC_RELEASE);
 		}
-		++j;
 	}
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  R E C E I V E  N E T W O R K                                                                                      *
- *  ============================                                                                                      *
+ *  S E R I A L  T H R E A D                                                                                          *
+ *  ========================                                                                                          *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Process blocks read from the network port.
- *  \param handle Internal handle that the data was received on.
- *  \param buffer Data that was received.
- *  \param len Size of data that was received.
+ *  \brief Thread that owns the serial port, it writes the lanes at the link speed and reads from DCC++.
+ *  \param arg Not used.
  *  \result None.
  */
-void receiveNetwork (int handle, char *buffer, int len)
+void *serialThread (void *arg)
 {
-	int j = 0;
+	struct pollfd fds[2];
+	dccStreamDef rxedStream;
 
-	while (j < len)
+	dccStreamInit (&rxedStream, RXED_BUFF_SIZE);
+	fds[0].fd = serialFD;
+	fds[1].fd = serialTxRing.wakeFD;
+	fds[1].events = POLLIN;
+
+	while (__atomic_load_n (&serialRunning, __ATOMIC_ACQUIRE))
 	{
-		handleInfo[handle].rxedBuff[handleInfo[handle].rxedPosn++] = buffer[j];
-		if (buffer[j] == '>')
-		{
-			handleInfo[handle].rxedBuff[handleInfo[handle].rxedPosn] = 0;
-			if (!checkNetworkRecvBuffer (handle, handleInfo[handle].rxedBuff, handleInfo[handle].rxedPosn))
-				sendSerial (handleInfo[handle].rxedBuff, len);
+		int waitTime;
 
-			handleInfo[handle].rxedPosn = 0;
-		}
-		if (handleInfo[handle].rxedPosn >= RXED_BUFF_SIZE)
+		spscWoken (&serialTxRing);
+		serialTakeQueue ();
+		waitTime = serialSend ();
+		if (__atomic_exchange_n (&serialDumpStats, 0, __ATOMIC_ACQ_REL))
+			dumpSerialStats ();
+
+		fds[0].events = serialBlocked ? POLLIN | POLLOUT : POLLIN;
+		if (poll (fds, 2, waitTime) > 0)
 		{
-			handleInfo[handle].rxedPosn = 0;
-			break;
+			if (fds[0].revents & POLLOUT)
+				serialBlocked = 0;
+			if (fds[0].revents & POLLIN)
+				readSerial (&rxedStream);
 		}
-		++j;
 	}
+	dccStreamFree (&rxedStream);
+	return NULL;
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  L O A D  C O N F I G  F I L E                                                                                     *
- *  =============================                                                                                     *
+ *  S T A R T  S E R I A L  T H R E A D                                                                               *
+ *  ===================================                                                                               *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Read the config file from disk and keep it in memory.
- *  \result True if it was read and parsed.
+ *  \brief Hand the serial port over to its own thread. Signals are blocked on the thread so they still go to the
+ *  main loop.
+ *  \result 1 if the thread was started.
  */
-int loadConfigFile ()
+int startSerialThread ()
 {
-	int retn = 0;
-	struct stat statbuf;
+	struct epoll_event event;
+	sigset_t allSignals, oldSignals;
 
-	if (stat (xmlConfigFile, &statbuf) == 0)
+	if (!spscInit (&serialTxRing, SERIAL_RING_SIZE) || !spscInit (&serialRxRing, SERIAL_RING_SIZE))
 	{
-		FILE *inFile = fopen (xmlConfigFile, "r");
-		if (inFile != NULL)
+		putLogMessage (LOG_ERR, "Out of memory for serial rings");
+		return 0;
+	}
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN | EPOLLET;
+	event.data.u32 = SERIAL_HANDLE;
+	if (epoll_ctl (epollFD, EPOLL_CTL_ADD, serialRxRing.wakeFD, &event) == -1)
+	{
+		putLogMessage (LOG_ERR, "Epoll add error: %s[%d]", strerror (errno), errno);
+		return 0;
+	}
+	dccDispatchInit (&serialSplitDispatch, serialSplitCommands);
+	serialFD = HINFO(SERIAL_HANDLE).handle;
+	serialRunning = 1;
+
+	sigfillset (&allSignals);
+	pthread_sigmask (SIG_BLOCK, &allSignals, &oldSignals);
+	if (pthread_create (&serialThreadID, NULL, serialThread, NULL) != 0)
+	{
+		putLogMessage (LOG_ERR, "Unable to start serial thread");
+		serialRunning = 0;
+	}
+	pthread_sigmask (SIG_SETMASK, &oldSignals, NULL);
+	return serialRunning;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  S T O P  S E R I A L  T H R E A D                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Stop the serial thread and wait for it to finish.
+ *  \result None.
+ */
+void stopSerialThread ()
+{
+	if (serialRunning)
+	{
+		__atomic_store_n (&serialRunning, 0, __ATOMIC_RELEASE);
+		spscWake (&serialTxRing);
+		pthread_join (serialThreadID, NULL);
+	}
+	spscFree (&serialTxRing);
+	spscFree (&serialRxRing);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  R E A D  S E R I A L  Q U E U E                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Handle the messages the serial thread has read from DCC++.
+ *  \result None.
+ */
+void readSerialQueue ()
+{
+	int len, tag;
+	char buffer[RXED_BUFF_SIZE];
+
+	spscWoken (&serialRxRing);
+	while ((len = spscGet (&serialRxRing, &tag, buffer)) >= 0)
+		dccParseBuffer (&serialDispatch, buffer, len, SERIAL_HANDLE, NULL);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  W A K E  S E R I A L                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Wake the serial thread once if anything was sent to it on this pass of the main loop.
+ *  \result None.
+ */
+void wakeSerial ()
+{
+	if (serialTxWake)
+	{
+		spscWake (&serialTxRing);
+		serialTxWake = 0;
+	}
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C L O S E  N E T W O R K                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief A client has gone, close it and tidy up anything that points at it.
+ *  \param handle Internal handle that closed.
+ *  \result None.
+ */
+void closeNetwork (int handle)
+{
+	int p;
+
+	putLogMessage (LOG_INFO, "Socket closed: %s(%d)", HINFO(handle).localName, HINFO(handle).handle);
+	closeHandle (handle);
+	if (HINFO(handle).handleType == CONTRL_HTYPE)
+	{
+		if (--connectedCount == 0)
+			sendSerial ("<0>", 3, SERIAL_URGENT);
+	}
+	else if (HINFO(handle).handleType == POINTC_HTYPE)
+	{
+		for (p = 0; p < trackCtrl.pServerCount; ++p)
 		{
-			xmlBufferSize = statbuf.st_size;
-			if ((xmlBuffer = (char *)malloc (xmlBufferSize + 10)) != NULL)
+			pointCtrlDef *point = &trackCtrl.pointCtrl[p];
+			if (point -> intHandle == handle)
 			{
-				if (fread (xmlBuffer, 1, xmlBufferSize, inFile) == xmlBufferSize)
-				{
-					retn = parseMemoryXML (&trackCtrl, xmlBuffer);
-				}
+				point -> intHandle = -1;
+				break;
 			}
-			fclose (inFile);
 		}
 	}
-	return retn;
+	freeHandle (handle);
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E N D  C O N F I G  F I L E                                                                                     *
- *  =============================                                                                                     *
+ *  R E A D  N E T W O R K                                                                                            *
+ *  ======================                                                                                            *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send out the current config file".
- *  \param newSocket Socket to send to.
+ *  \brief Read everything waiting on a client socket, as it is edge triggered we must drain it.
+ *  \param handle Internal handle to read.
  *  \result None.
  */
-void sendConfigFile (int newSocket)
+void readNetwork (int handle)
 {
-	if (xmlBufferSize && xmlBuffer != NULL)
-		SendSocket (newSocket, xmlBuffer, xmlBufferSize);
+	int readBytes;
+	char buffer[10241];
+
+	while (HINFO(handle).handle != -1)
+	{
+		if ((readBytes = RecvSocketNB (HINFO(handle).handle, buffer, 10240)) > 0)
+		{
+			buffer[readBytes] = 0;
+			dccParseStream (&HINFO(handle).rxedStream, &networkDispatch, buffer, readBytes, handle, NULL);
+			if (HINFO(handle).handleType == CONTRL_HTYPE)
+				lastRxed = time (NULL);
+		}
+		else
+		{
+			if (readBytes == 0)
+				closeNetwork (handle);
+			break;
+		}
+	}
 }
 
 /**********************************************************************************************************************
  *                                                                                                                    *
- *  S E N D  A L L  F U N C T I O N S                                                                                 *
- *  =================================                                                                                 *
+ *  W R I T E  N E T W O R K                                                                                          *
+ *  ========================                                                                                          *
  *                                                                                                                    *
  **********************************************************************************************************************/
 /**
- *  \brief Send out the state of the functions.
- *  \param handle Where to send it, connecting client.
+ *  \brief A slow client can take more, send it what has been queued for it.
+ *  \param handle Internal handle to write to.
  *  \result None.
  */
-void sendAllFunctions (int handle)
+void writeNetwork (int handle)
 {
-	int t, j;
-	char tempBuff[81];
-	if (trackCtrl.trainCtrl != NULL)
+	if (HINFO(handle).ringLen > 0 && ringSend (handle) == -1)
+		closeNetwork (handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C H E C K  A C C E P T                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Once the back off after running out of files is over re-arm the listening handles, so any
+ *  connections still waiting are reported again.
+ *  \result Milliseconds until the back off is over, or -1 if there is none.
+ */
+int checkAccept ()
+{
+	int i;
+	long long now;
+
+	if (acceptRetryAt == 0)
+		return -1;
+
+	now = getMsTime ();
+	if (acceptRetryAt > now)
+		return (int)(acceptRetryAt - now);
+
+	acceptRetryAt = 0;
+	for (i = LISTEN_HANDLE; i < FIRST_HANDLE; ++i)
 	{
-		for (t = 0; t < trackCtrl.trainCount; ++t)
-		{
-			trainCtrlDef *train = &trackCtrl.trainCtrl[t];
+		if (HINFO(i).handle != -1)
+			epollRearmHandle (i, EPOLLIN);
+	}
+	return -1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C H E C K  T I M E R S                                                                                            *
+ *  ======================                                                                                            *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Run the current poll and idle timers, and work out when they next need to run.
+ *  \result Milliseconds to wait for, or -1 if there is nothing to wait for.
+ */
+int checkTimers ()
+{
+	int waitTime = -1, coalesceWait, acceptWait;
 
-			for (j = 0; j < train -> funcCount; ++j)
+	if (trackCtrl.powerState == POWER_ON)
+	{
+		time_t nextTime, now = time (NULL);
+
+		if (curRead < now)
+		{
+			if (__atomic_load_n (&serialPolls, __ATOMIC_ACQUIRE) == 0)
+				sendSerial ("<c>", 3, SERIAL_POLL);
+			curRead = now + 2;
+		}
+		nextTime = curRead + 1;
+		if (trackCtrl.idleOff > 0)
+		{
+			if (now - lastRxed > trackCtrl.idleOff)
 			{
-				int funcID = train -> trainFunc[j].funcID;
-				if (train -> funcState[funcID] == 1)
-				{
-					sprintf (tempBuff, "<F %d %d 1>", train -> trainID, funcID);
-					SendSocket (handle, tempBuff, strlen (tempBuff));
-				}
+				putLogMessage (LOG_INFO, "Idle timeout reached turning off power");
+				sendSerial ("<0>", 3, SERIAL_URGENT);
+				lastRxed = now;
 			}
+			if (lastRxed + trackCtrl.idleOff + 1 < nextTime)
+				nextTime = lastRxed + trackCtrl.idleOff + 1;
 		}
+		waitTime = nextTime > now ? (int)(nextTime - now) * 1000 : 0;
 	}
+	if ((coalesceWait = checkCoalesce ()) != -1 && (waitTime == -1 || coalesceWait < waitTime))
+		waitTime = coalesceWait;
+	if ((acceptWait = checkAccept ()) != -1 && (waitTime == -1 || acceptWait < waitTime))
+		waitTime = acceptWait;
+
+	return waitTime;
 }
 
 /**********************************************************************************************************************
@@ -1029,12 +3187,11 @@ void helpThem()
  */
 int main (int argc, char *argv[])
 {
-	fd_set readfds;
-	struct timeval timeout;
-	char inAddress[50] = "";
-	int i, c, p, connectedCount = 0;
-	time_t curRead = time (NULL) + 5;
-	time_t lastRxed = time (NULL);
+	struct epoll_event events[MAX_EVENTS];
+	int i, c, p;
+
+	curRead = time (NULL) + 5;
+	lastRxed = time (NULL);
 
 	while ((c = getopt(argc, argv, "c:dLID?")) != -1)
 	{
@@ -1069,11 +3226,29 @@ int main (int argc, char *argv[])
 	/**********************************************************************************************************************
 	 * Allocate and read in the configuration.                                                                            *
 	 **********************************************************************************************************************/
+	trackCtrl.coalesceTime = COALESCE_DEFAULT;
+	trackCtrl.powerState = POWER_SRT;
 	if (!loadConfigFile())
 		parseMemoryXML (&trackCtrl, NULL);
 
-	for (i = 0; i < MAX_HANDLES; ++i)
-		handleInfo[i].handle = -1;
+	if (trackCtrl.trainCount > 0)
+		trainCoalesce = (trainCoalesceDef *)calloc (trackCtrl.trainCount, sizeof (trainCoalesceDef));
+
+	if (trackCtrl.txQueueSize <= 0)
+		trackCtrl.txQueueSize = TXQUEUE_DEFAULT;
+
+	dccDispatchInit (&serialDispatch, serialCommands);
+	dccDispatchInit (&networkDispatch, networkCommands);
+	signal (SIGUSR1, sigHandler);
+
+	for (i = SERIAL_HANDLE; i < FIRST_HANDLE; ++i)
+	{
+		if (allocHandle () != i)
+		{
+			putLogMessage (LOG_ERR, "Unable to allocate handle table");
+			exit (1);
+		}
+	}
 
 	/**********************************************************************************************************************
 	 * Daemonize if needed, all port will close.                                                                          *
@@ -1084,50 +3259,50 @@ int main (int argc, char *argv[])
 	/**********************************************************************************************************************
 	 * Setup listening serial and network ports.                                                                          *
 	 **********************************************************************************************************************/
-	handleInfo[SERIAL_HANDLE].handle = serialPortSetup (trackCtrl.serialDevice);
-	if (handleInfo[SERIAL_HANDLE].handle == -1)
+	HINFO(SERIAL_HANDLE).handle = serialPortSetup (trackCtrl.serialDevice);
+	if (HINFO(SERIAL_HANDLE).handle == -1)
 	{
 		putLogMessage (LOG_ERR, "Unable to connect to: %s", trackCtrl.serialDevice);
 	}
 	else
 	{
-		handleInfo[SERIAL_HANDLE].handleType = SERIAL_HTYPE;
+		HINFO(SERIAL_HANDLE).handleType = SERIAL_HTYPE;
 		putLogMessage (LOG_INFO, "Listening on serial: %s", trackCtrl.serialDevice);
 
 		if (trackCtrl.configPort > 0)
 		{
-			handleInfo[CONFIG_HANDLE].handle = ServerSocketSetup (trackCtrl.configPort);
-			if (handleInfo[CONFIG_HANDLE].handle == -1)
+			HINFO(CONFIG_HANDLE).handle = ServerSocketSetup (trackCtrl.configPort);
+			if (HINFO(CONFIG_HANDLE).handle == -1)
 			{
 				putLogMessage (LOG_ERR, "Unable to listen on config port.");
 			}
 			else
 			{
-				handleInfo[CONFIG_HANDLE].handleType = CONFIG_HTYPE;
+				HINFO(CONFIG_HANDLE).handleType = CONFIG_HTYPE;
 				putLogMessage (LOG_INFO, "Listening on port: %d", trackCtrl.configPort);
 			}
 		}
 		if (trackCtrl.pointPort > 0)
 		{
-			handleInfo[POINTL_HANDLE].handle = ServerSocketSetup (trackCtrl.pointPort);
-			if (handleInfo[POINTL_HANDLE].handle == -1)
+			HINFO(POINTL_HANDLE).handle = ServerSocketSetup (trackCtrl.pointPort);
+			if (HINFO(POINTL_HANDLE).handle == -1)
 			{
 				putLogMessage (LOG_ERR, "Unable to listen on point port.");
 			}
 			else
 			{
-				handleInfo[POINTL_HANDLE].handleType = POINTL_HTYPE;
+				HINFO(POINTL_HANDLE).handleType = POINTL_HTYPE;
 				putLogMessage (LOG_INFO, "Listening on port: %d", trackCtrl.pointPort);
 			}
 		}
-		handleInfo[LISTEN_HANDLE].handle = ServerSocketSetup (trackCtrl.serverPort);
-		if (handleInfo[LISTEN_HANDLE].handle == -1)
+		HINFO(LISTEN_HANDLE).handle = ServerSocketSetup (trackCtrl.serverPort);
+		if (HINFO(LISTEN_HANDLE).handle == -1)
 		{
 			putLogMessage (LOG_ERR, "Unable to listen on network port.");
 		}
 		else
 		{
-			handleInfo[LISTEN_HANDLE].handleType = LISTEN_HTYPE;
+			HINFO(LISTEN_HANDLE).handleType = LISTEN_HTYPE;
 			putLogMessage (LOG_INFO, "Listening on port: %d", trackCtrl.serverPort);
 		}
 	}
@@ -1141,184 +3316,97 @@ int main (int argc, char *argv[])
 	}
 
 	/**********************************************************************************************************************
-	 * Loop on select, getting and sending work.                                                                          *
+	 * Register the open handles with epoll, clients are added as they connect.                                           *
 	 **********************************************************************************************************************/
-	while (handleInfo[LISTEN_HANDLE].handle != -1 && running)
+	if ((epollFD = epoll_create1 (EPOLL_CLOEXEC)) == -1)
 	{
-		int selRetn;
-		time_t now = 0;
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
-
-		FD_ZERO(&readfds);
-		for (i = 0; i < MAX_HANDLES; ++i)
-		{
-			if (handleInfo[i].handle != -1)
-				FD_SET (handleInfo[i].handle, &readfds);
-		}
-		selRetn = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
-		if (selRetn == -1)
+		putLogMessage (LOG_ERR, "Epoll create error: %s[%d]", strerror (errno), errno);
+		CloseSocket (&HINFO(LISTEN_HANDLE).handle);
+	}
+	for (i = LISTEN_HANDLE; i < FIRST_HANDLE && epollFD != -1; ++i)
+	{
+		if (HINFO(i).handle != -1)
 		{
-			putLogMessage (LOG_ERR, "Select error: %s[%d]", strerror (errno), errno);
-			CloseSocket (&handleInfo[0].handle);
+			setNonBlocking (HINFO(i).handle, 1);
+			epollAddHandle (i, EPOLLIN);
 		}
-		if (selRetn > 0)
+	}
+	if (HINFO(SERIAL_HANDLE).handle != -1 && epollFD != -1 && !startSerialThread ())
+		CloseSocket (&HINFO(LISTEN_HANDLE).handle);
+
+	/**********************************************************************************************************************
+	 * Loop on epoll, getting and sending work.                                                                           *
+	 **********************************************************************************************************************/
+	while (HINFO(LISTEN_HANDLE).handle != -1 && running)
+	{
+		int e, eventCount, waitTime;
+
+		waitTime = checkTimers ();
+		flushSendQueues ();
+		wakeSerial ();
+		eventCount = epoll_wait (epollFD, events, MAX_EVENTS, waitTime);
+
+		if (dumpStats)
 		{
-			if (FD_ISSET(handleInfo[LISTEN_HANDLE].handle, &readfds))
-			{
-				int newSocket = ServerSocketAccept (handleInfo[LISTEN_HANDLE].handle, inAddress);
-				if (newSocket != -1)
-				{
-					for (i = FIRST_HANDLE; i < MAX_HANDLES; ++i)
-					{
-						if (handleInfo[i].handle == -1)
-						{
-							char outBuffer[41];
-							handleInfo[i].handle = newSocket;
-							handleInfo[i].handleType = CONTRL_HTYPE;
-							strncpy (handleInfo[i].localName, inAddress, 50);
-							putLogMessage (LOG_INFO, "Socket opened: %s(%d)", handleInfo[i].localName, handleInfo[i].handle);
-							sprintf (outBuffer, "<V %d>", handleInfo[i].handle);
-							SendSocket (handleInfo[i].handle, outBuffer, strlen (outBuffer));
-							sendSerial ("<s>", 3);
-							getAllPointStates ();
-							sendAllFunctions (handleInfo[i].handle);
-							++connectedCount;
-							break;
-						}
-					}
-					if (i == MAX_HANDLES)
-					{
-						putLogMessage (LOG_ERR, "No free handles.");
-						CloseSocket (&newSocket);
-					}
-				}
-			}
-			if (FD_ISSET(handleInfo[POINTL_HANDLE].handle, &readfds))
-			{
-				int newSocket = ServerSocketAccept (handleInfo[POINTL_HANDLE].handle, inAddress);
-				if (newSocket != -1)
-				{
-					int done = 0;
-					for (i = FIRST_HANDLE; i < MAX_HANDLES && !done; ++i)
-					{
-						if (handleInfo[i].handle == -1)
-						{
-							if (trackCtrl.pointCtrl != NULL)
-							{
-								for (p = 0; p < trackCtrl.pServerCount && !done; ++p)
-								{
-									if (trackCtrl.pointCtrl[p].intHandle == -1)
-									{
-										trackCtrl.pointCtrl[p].intHandle = i;
-										handleInfo[i].handle = newSocket;
-										handleInfo[i].handleType = POINTC_HTYPE;
-										strncpy (handleInfo[i].localName, inAddress, 50);
-										putLogMessage (LOG_INFO, "Socket opened: %s(%d)", handleInfo[i].localName, handleInfo[i].handle);
-										done = 1;
-									}
-								}
-								if (!done)
-									putLogMessage (LOG_INFO, "All point servers are already conneted: %s(%d).", inAddress, newSocket);
-							}
-							else
-							{
-								putLogMessage (LOG_INFO, "No point control configured.");
-							}
-						}
-					}
-					if (i == MAX_HANDLES)
-					{
-						putLogMessage (LOG_ERR, "No free handles: %s(%d).", inAddress, newSocket);
-					}
-					if (!done)
-						CloseSocket (&newSocket);
-				}
-			}
-			if (FD_ISSET(handleInfo[CONFIG_HANDLE].handle, &readfds))
-			{
-				int newSocket = ServerSocketAccept (handleInfo[CONFIG_HANDLE].handle, inAddress);
-				if (newSocket != -1)
-				{
-					sendConfigFile (newSocket);
-					CloseSocket (&newSocket);
-				}
-			}
-			if (FD_ISSET(handleInfo[SERIAL_HANDLE].handle, &readfds))
-			{
-				int readBytes;
-				char buffer[10241];
-				if ((readBytes = read (handleInfo[SERIAL_HANDLE].handle, buffer, 10240)) > 0)
-				{
-					buffer[readBytes] = 0;
-					putLogMessage (LOG_DEBUG, "Received <- Serial: %s[%d]", buffer, readBytes);
-					receiveSerial (SERIAL_HANDLE, buffer, readBytes);
-				}
-			}
-			for (i = FIRST_HANDLE; i < MAX_HANDLES; ++i)
+			dumpDispatchStats ("Serial", &serialDispatch);
+			dumpDispatchStats ("Network", &networkDispatch);
+			putLogMessage (LOG_INFO, "Throttle messages coalesced: %lu", coalescedCount);
+			if (serialRunning)
 			{
-				if (handleInfo[i].handle != -1)
-				{
-					if (FD_ISSET(handleInfo[i].handle, &readfds))
-					{
-						int readBytes;
-						char buffer[10241];
-
-						if ((readBytes = RecvSocket (handleInfo[i].handle, buffer, 10240)) > 0)
-						{
-							buffer[readBytes] = 0;
-							receiveNetwork (i, buffer, readBytes);
-							if (handleInfo[i].handleType == CONTRL_HTYPE)
-								lastRxed = time (NULL);
-						}
-						else if (readBytes == 0)
-						{
-							putLogMessage (LOG_INFO, "Socket closed: %s(%d)", handleInfo[i].localName, handleInfo[i].handle);
-							CloseSocket (&handleInfo[i].handle);
-							if (handleInfo[i].handleType == CONTRL_HTYPE)
-							{
-								if (--connectedCount == 0)
-									sendSerial ("<0>", 3);
-							}
-							else if (handleInfo[i].handleType == POINTC_HTYPE)
-							{
-								for (p = 0; p < trackCtrl.pServerCount; ++p)
-								{
-									pointCtrlDef *point = &trackCtrl.pointCtrl[p];
-									if (point -> intHandle == i)
-									{
-										point -> intHandle = -1;
-										break;
-									}
-								}
-							}
-						}
-					}
-				}
+				__atomic_store_n (&serialDumpStats, 1, __ATOMIC_RELEASE);
+				spscWake (&serialTxRing);
 			}
+			dumpStats = 0;
 		}
-		if (trackCtrl.powerState == POWER_ON)
+		if (eventCount == -1)
 		{
-			now = time (NULL);
-			if (curRead < now)
-			{
-				sendSerial ("<c>", 3);
-				curRead = now + 2;
-			}
-			if (trackCtrl.idleOff > 0)
+			if (errno != EINTR)
+				putLogMessage (LOG_ERR, "Epoll wait error: %s[%d]", strerror (errno), errno);
+			continue;
+		}
+		for (e = 0; e < eventCount; ++e)
+		{
+			i = events[e].data.u32;
+			if (HINFO(i).handle == -1)
+				continue;
+
+			switch (HINFO(i).handleType)
 			{
-				if (now - lastRxed > trackCtrl.idleOff)
-				{
-					putLogMessage (LOG_INFO, "Idle timeout reached turning off power");
-					sendSerial ("<0>", 3);
-					lastRxed = now;
-				}
+			case LISTEN_HTYPE:
+				acceptController ();
+				break;
+
+			case POINTL_HTYPE:
+				acceptPointServer ();
+				break;
+
+			case CONFIG_HTYPE:
+				acceptConfig ();
+				break;
+
+			case CONFGC_HTYPE:
+				sendConfigPart (i);
+				break;
+
+			case SERIAL_HTYPE:
+				readSerialQueue ();
+				break;
+
+			default:
+				if (events[e].events & EPOLLOUT)
+					writeNetwork (i);
+				if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+					readNetwork (i);
+				break;
 			}
 		}
 	}
 	/**********************************************************************************************************************
 	 * Killed so tidy up.                                                                                                 *
 	 **********************************************************************************************************************/
+	stopSerialThread ();
+	if (epollFD != -1)
+		close (epollFD);
 	unlink (pidFileName);
 	return 0;
 }
@@ -80,7 +80,7 @@ void processFunction (trackCtrlDef *trackCtrl, xmlNode *inNode, int count, train
 	if ((train -> trainFunc = (trainFuncDef *)malloc (count * sizeof (trainFuncDef))) == NULL)
 		return;
 
-	memset (train -> funcState, 0, 100);
+	memset (train -> funcState, 0, sizeof (train -> funcState));
 	memset (train -> trainFunc, 0, count * sizeof (trainFuncDef));
 
 	for (curNode = inNode; curNode; curNode = curNode->next)
@@ -110,7 +110,7 @@ void processFunction (trackCtrlDef *trackCtrl, xmlNode *inNode, int count, train
 
 						sscanf ((char *)idStr, "%d", &id);
 
-						if (id != -1 && loop < count)
+						if (id >= 0 && id < FUNC_MAX && loop < count)
 						{
 							train -> trainFunc[loop].funcID = id;
 							train -> trainFunc[loop].trigger = trigger;
@@ -166,6 +166,48 @@ void processFunctions (trackCtrlDef *trackCtrl, xmlNode *inNode, trainCtrlDef *t
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  B U I L D  T R A I N  I N D E X                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Build the tables to go from a DCC address or a register straight to the train, if two trains have the
+ *  same address the first one is used.
+ *  \param trackCtrl Which is the active track.
+ *  \param count Number of trains allocated.
+ *  \result None.
+ */
+static void buildTrainIndex (trackCtrlDef *trackCtrl, int count)
+{
+	int i;
+
+	trackCtrl -> trainByID = (short *)malloc (TRAIN_ID_MAX * sizeof (short));
+	trackCtrl -> trainByReg = (short *)malloc ((count + 1) * sizeof (short));
+	if (trackCtrl -> trainByID == NULL || trackCtrl -> trainByReg == NULL)
+	{
+		free (trackCtrl -> trainByID);
+		free (trackCtrl -> trainByReg);
+		trackCtrl -> trainByID = trackCtrl -> trainByReg = NULL;
+		return;
+	}
+	for (i = 0; i < TRAIN_ID_MAX; ++i)
+		trackCtrl -> trainByID[i] = -1;
+	for (i = 0; i <= count; ++i)
+		trackCtrl -> trainByReg[i] = -1;
+
+	for (i = 0; i < trackCtrl -> trainCount; ++i)
+	{
+		trainCtrlDef *train = &trackCtrl -> trainCtrl[i];
+
+		if (train -> trainID >= 0 && train -> trainID < TRAIN_ID_MAX && trackCtrl -> trainByID[train -> trainID] == -1)
+			trackCtrl -> trainByID[train -> trainID] = i;
+		if (train -> trainReg >= 0 && train -> trainReg <= count)
+			trackCtrl -> trainByReg[train -> trainReg] = i;
+	}
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P R O C E S S  T R A I N S                                                                                        *
@@ -230,6 +272,48 @@ void processTrains (trackCtrlDef *trackCtrl, xmlNode *inNode, int count)
 		}
 	}
 	trackCtrl -> trainCount = loop;
+	buildTrainIndex (trackCtrl, count);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F I N D  T R A I N  B Y  I D                                                                                      *
+ *  ============================                                                                                      *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find a train from its DCC address.
+ *  \param trackCtrl Which is the active track.
+ *  \param trainID DCC address of the train.
+ *  \result Pointer to the train, NULL if there is not one.
+ */
+trainCtrlDef *findTrainByID (trackCtrlDef *trackCtrl, int trainID)
+{
+	if (trackCtrl -> trainByID == NULL || trainID < 0 || trainID >= TRAIN_ID_MAX || trackCtrl -> trainByID[trainID] < 0)
+		return NULL;
+
+	return &trackCtrl -> trainCtrl[trackCtrl -> trainByID[trainID]];
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F I N D  T R A I N  B Y  R E G                                                                                    *
+ *  ==============================                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find a train from the register used for it on the command station.
+ *  \param trackCtrl Which is the active track.
+ *  \param trainReg Register of the train.
+ *  \result Pointer to the train, NULL if there is not one.
+ */
+trainCtrlDef *findTrainByReg (trackCtrlDef *trackCtrl, int trainReg)
+{
+	if (trackCtrl -> trainByReg == NULL || trainReg < 0 || trainReg > trackCtrl -> trainCount ||
+			trackCtrl -> trainByReg[trainReg] < 0)
+		return NULL;
+
+	return &trackCtrl -> trainCtrl[trackCtrl -> trainByReg[trainReg]];
 }
 
 /**********************************************************************************************************************
@@ -358,6 +442,204 @@ void processRelays (trackCtrlDef *trackCtrl, xmlNode *inNode, int count)
 	trackCtrl -> relayCount = loop;
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  G E T  T R A C K  C E L L                                                                                         *
+ *  =========================                                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get a cell from the layout, cells are kept in tiles and only tiles with something in them exist.
+ *  \param trackLayout Layout to look in.
+ *  \param row Row of the cell.
+ *  \param col Column of the cell.
+ *  \result Pointer to the cell, NULL if the cell is empty.
+ */
+trackCellDef *getTrackCell (trackLayoutDef *trackLayout, int row, int col)
+{
+	trackTileDef *tile;
+
+	if (trackLayout == NULL || row < 0 || col < 0 || row >= trackLayout -> trackRows || col >= trackLayout -> trackCols)
+		return NULL;
+
+	tile = trackLayout -> trackTiles[(row >> TRACK_TILE_SHIFT) * trackLayout -> tileCols + (col >> TRACK_TILE_SHIFT)];
+	if (tile == NULL || !(tile -> occupied[row & TRACK_TILE_MASK] & (1 << (col & TRACK_TILE_MASK))))
+		return NULL;
+
+	return &tile -> cells[((row & TRACK_TILE_MASK) << TRACK_TILE_SHIFT) + (col & TRACK_TILE_MASK)];
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  G E T  T R A C K  C E L L  P O S N                                                                                *
+ *  ==================================                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find the row and column of a cell, by finding the tile that holds it.
+ *  \param trackLayout Layout to look in.
+ *  \param cell Cell to find.
+ *  \param row Return the row of the cell.
+ *  \param col Return the column of the cell.
+ *  \result 1 if the cell was found, 0 if not.
+ */
+int getTrackCellPosn (trackLayoutDef *trackLayout, trackCellDef *cell, int *row, int *col)
+{
+	int i;
+
+	if (trackLayout == NULL || trackLayout -> trackTiles == NULL || cell == NULL)
+		return 0;
+
+	for (i = 0; i < trackLayout -> tileRows * trackLayout -> tileCols; ++i)
+	{
+		trackTileDef *tile = trackLayout -> trackTiles[i];
+
+		if (tile != NULL && cell >= tile -> cells && cell < &tile -> cells[TRACK_TILE_SIZE * TRACK_TILE_SIZE])
+		{
+			int offset = cell - tile -> cells;
+
+			*row = ((i / trackLayout -> tileCols) << TRACK_TILE_SHIFT) + (offset >> TRACK_TILE_SHIFT);
+			*col = ((i % trackLayout -> tileCols) << TRACK_TILE_SHIFT) + (offset & TRACK_TILE_MASK);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  A D D  T R A C K  C E L L                                                                                         *
+ *  =========================                                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add an empty cell to the layout, creating its tile if this is the first cell in it.
+ *  \param trackLayout Layout to add to.
+ *  \param row Row of the cell.
+ *  \param col Column of the cell.
+ *  \result Pointer to the cell, NULL if it is outside the layout or we ran out of memory.
+ */
+trackCellDef *addTrackCell (trackLayoutDef *trackLayout, int row, int col)
+{
+	trackTileDef **tile;
+	trackCellDef *cell;
+
+	if (trackLayout == NULL || row < 0 || col < 0 || row >= trackLayout -> trackRows || col >= trackLayout -> trackCols)
+		return NULL;
+
+	tile = &trackLayout -> trackTiles[(row >> TRACK_TILE_SHIFT) * trackLayout -> tileCols + (col >> TRACK_TILE_SHIFT)];
+	if (*tile == NULL)
+	{
+		if ((*tile = (trackTileDef *)malloc (sizeof (trackTileDef))) == NULL)
+			return NULL;
+		memset (*tile, 0, sizeof (trackTileDef));
+	}
+	(*tile) -> occupied[row & TRACK_TILE_MASK] |= (1 << (col & TRACK_TILE_MASK));
+	cell = &(*tile) -> cells[((row & TRACK_TILE_MASK) << TRACK_TILE_SHIFT) + (col & TRACK_TILE_MASK)];
+	memset (cell, 0, sizeof (trackCellDef));
+	return cell;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T R A C K  C E L L  F I R S T                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Start going through the cells in part of the layout, empty tiles and cells are skipped.
+ *  \param trackLayout Layout to look in.
+ *  \param iter Iterator to set up.
+ *  \param rowStart First row.
+ *  \param colStart First column.
+ *  \param rowEnd Row after the last one.
+ *  \param colEnd Column after the last one.
+ *  \result Pointer to the first cell, iter has its row and column, NULL if there are none.
+ */
+trackCellDef *trackCellFirst (trackLayoutDef *trackLayout, cellIterDef *iter, int rowStart, int colStart,
+		int rowEnd, int colEnd)
+{
+	memset (iter, 0, sizeof (cellIterDef));
+	if (trackLayout == NULL)
+		return NULL;
+
+	iter -> rowStart = rowStart < 0 ? 0 : rowStart;
+	iter -> colStart = colStart < 0 ? 0 : colStart;
+	iter -> rowEnd = rowEnd > (int)trackLayout -> trackRows ? (int)trackLayout -> trackRows : rowEnd;
+	iter -> colEnd = colEnd > (int)trackLayout -> trackCols ? (int)trackLayout -> trackCols : colEnd;
+	if (iter -> rowStart >= iter -> rowEnd || iter -> colStart >= iter -> colEnd)
+	{
+		iter -> rowStart = iter -> rowEnd = iter -> colStart = iter -> colEnd = 0;
+		return NULL;
+	}
+	iter -> tileRow = iter -> rowStart >> TRACK_TILE_SHIFT;
+	iter -> tileCol = iter -> colStart >> TRACK_TILE_SHIFT;
+	iter -> row = iter -> rowStart - 1;
+	return trackCellNext (trackLayout, iter);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T R A C K  C E L L  N E X T                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Get the next cell, tile by tile, then row by row within a tile.
+ *  \param trackLayout Layout to look in.
+ *  \param iter Iterator from trackCellFirst.
+ *  \result Pointer to the next cell, iter has its row and column, NULL if there are no more.
+ */
+trackCellDef *trackCellNext (trackLayoutDef *trackLayout, cellIterDef *iter)
+{
+	int bit = 0;
+
+	while (iter -> bits == 0)
+	{
+		int tileFirst = iter -> tileRow << TRACK_TILE_SHIFT;
+		int tileEnd = tileFirst + TRACK_TILE_SIZE < iter -> rowEnd ? tileFirst + TRACK_TILE_SIZE : iter -> rowEnd;
+
+		if (++iter -> row >= tileEnd)
+		{
+			if ((++iter -> tileCol << TRACK_TILE_SHIFT) >= iter -> colEnd)
+			{
+				iter -> tileCol = iter -> colStart >> TRACK_TILE_SHIFT;
+				if ((++iter -> tileRow << TRACK_TILE_SHIFT) >= iter -> rowEnd)
+					return NULL;
+			}
+			tileFirst = iter -> tileRow << TRACK_TILE_SHIFT;
+			iter -> row = tileFirst > iter -> rowStart ? tileFirst : iter -> rowStart;
+		}
+		iter -> tile = trackLayout -> trackTiles[iter -> tileRow * trackLayout -> tileCols + iter -> tileCol];
+		if (iter -> tile == NULL)
+		{
+			/*----------------------------------------------------------------------------------------*
+			 * Nothing in this tile, move to the last row so the next pass goes on to the next tile.  *
+			 *----------------------------------------------------------------------------------------*/
+			tileFirst = iter -> tileRow << TRACK_TILE_SHIFT;
+			iter -> row = (tileFirst + TRACK_TILE_SIZE < iter -> rowEnd ? tileFirst + TRACK_TILE_SIZE : iter -> rowEnd) - 1;
+		}
+		else
+		{
+			int colFirst = iter -> tileCol << TRACK_TILE_SHIFT;
+			unsigned int mask = (1 << TRACK_TILE_SIZE) - 1;
+
+			if (iter -> colStart > colFirst)
+				mask &= mask << (iter -> colStart - colFirst);
+			if (iter -> colEnd < colFirst + TRACK_TILE_SIZE)
+				mask &= (1 << (iter -> colEnd - colFirst)) - 1;
+
+			iter -> bits = iter -> tile -> occupied[iter -> row & TRACK_TILE_MASK] & mask;
+		}
+	}
+	while (!(iter -> bits & (1 << bit)))
+		++bit;
+
+	iter -> bits &= ~(1 << bit);
+	iter -> col = (iter -> tileCol << TRACK_TILE_SHIFT) + bit;
+	return &iter -> tile -> cells[((iter -> row & TRACK_TILE_MASK) << TRACK_TILE_SHIFT) + bit];
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P R O C E S S  C E L L                                                                                            *
@@ -382,72 +664,70 @@ void processCell (trackCtrlDef *trackCtrl, xmlNode *inNode, int rowNum)
 			if (strcmp ((char *)curNode->name, "cell") == 0)
 			{
 				xmlChar *tempStr;
+				trackCellDef *cell;
+
 				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"col")) != NULL)
 				{
 					int colNum = -1;
 					sscanf ((char *)tempStr, "%d", &colNum);
 					xmlFree(tempStr);
 
-					if (colNum > -1)
+					if ((cell = addTrackCell (trackCtrl -> trackLayout, rowNum, colNum)) != NULL)
 					{
 						int i, pointState = 0, point = 0;
-						int posn = (rowNum * trackCtrl -> trackLayout -> trackCols) + colNum;
-						memset (&trackCtrl -> trackLayout -> trackCells[posn], 0, sizeof (trackCellDef));
 
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"layout")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].layout);
+							sscanf ((char *)tempStr, "%hu", &cell -> layout);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"point")) != NULL)
 						{
 							sscanf ((char *)tempStr, "%d", &point);
 							xmlFree(tempStr);
-							trackCtrl -> trackLayout -> trackCells[posn].point.point = point;
+							cell -> point.point = point;
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"state")) != NULL)
 						{
 							sscanf ((char *)tempStr, "%d", &pointState);
 							xmlFree(tempStr);
-							trackCtrl -> trackLayout -> trackCells[posn].point.pointDef =
-									trackCtrl -> trackLayout -> trackCells[posn].point.state = pointState;
+							cell -> point.pointDef = cell -> point.state = pointState;
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"link")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].point.link);
+							sscanf ((char *)tempStr, "%hu", &cell -> point.link);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"server")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].point.server);
+							sscanf ((char *)tempStr, "%hu", &cell -> point.server);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"ident")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].point.ident);
+							sscanf ((char *)tempStr, "%hu", &cell -> point.ident);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"signal")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].signal.signal);
+							sscanf ((char *)tempStr, "%hu", &cell -> signal.signal);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"sserver")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].signal.server);
+							sscanf ((char *)tempStr, "%hu", &cell -> signal.server);
 							xmlFree(tempStr);
 						}
 						if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"sident")) != NULL)
 						{
-							sscanf ((char *)tempStr, "%hu", &trackCtrl -> trackLayout -> trackCells[posn].signal.ident);
+							sscanf ((char *)tempStr, "%hu", &cell -> signal.ident);
 							xmlFree(tempStr);
 						}
 						for (i = 0; i < 8 && point && pointState == 0; ++i)
 						{
 							if (point & (1 << i))
 							{
-								trackCtrl -> trackLayout -> trackCells[posn].point.pointDef =
-										trackCtrl -> trackLayout -> trackCells[posn].point.state = (1 << i);
+								cell -> point.pointDef = cell -> point.state = (1 << i);
 								break;
 							}
 						}
@@ -458,6 +738,263 @@ void processCell (trackCtrlDef *trackCtrl, xmlNode *inNode, int rowNum)
 	}
 }
 
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C E L L  H A S H                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Work out where a server and ident pair starts in the cell index.
+ *  \param key Server in the top 16 bits, ident in the bottom 16 bits.
+ *  \param mask Size of the index less one.
+ *  \result Position in the index.
+ */
+unsigned int cellHash (unsigned int key, unsigned int mask)
+{
+	key ^= key >> 15;
+	key *= 0x2c1b3c6d;
+	key ^= key >> 12;
+	return key & mask;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C E L L  I N D E X  A D D                                                                                         *
+ *  =========================                                                                                         *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Add a cell to a point or signal index, if the pair is already there the first cell is kept.
+ *  \param trackLayout Layout the index is for.
+ *  \param index Point or signal index.
+ *  \param server Server that controls the cell.
+ *  \param ident Identity on that server.
+ *  \param cell Cell to add.
+ *  \result None.
+ */
+void cellIndexAdd (trackLayoutDef *trackLayout, cellIndexDef *index, int server, int ident, trackCellDef *cell)
+{
+	unsigned int key = ((unsigned int)server << 16) | (unsigned int)ident;
+	unsigned int posn = cellHash (key, trackLayout -> indexMask);
+
+	while (index[posn].cell != NULL)
+	{
+		if (index[posn].key == key)
+			return;
+		posn = (posn + 1) & trackLayout -> indexMask;
+	}
+	index[posn].key = key;
+	index[posn].cell = cell;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  C E L L  I N D E X  F I N D                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Look up a server and ident pair in a point or signal index.
+ *  \param trackLayout Layout the index is for.
+ *  \param index Point or signal index.
+ *  \param server Server that controls the cell.
+ *  \param ident Identity on that server.
+ *  \result Pointer to the cell, NULL if there is not one.
+ */
+trackCellDef *cellIndexFind (trackLayoutDef *trackLayout, cellIndexDef *index, int server, int ident)
+{
+	unsigned int key = ((unsigned int)server << 16) | (unsigned int)ident;
+	unsigned int posn;
+
+	if (trackLayout == NULL || index == NULL)
+		return NULL;
+
+	posn = cellHash (key, trackLayout -> indexMask);
+	while (index[posn].cell != NULL)
+	{
+		if (index[posn].key == key)
+			return index[posn].cell;
+		posn = (posn + 1) & trackLayout -> indexMask;
+	}
+	return NULL;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F I N D  P O I N T  C E L L                                                                                       *
+ *  ===========================                                                                                       *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find the cell with a point on it.
+ *  \param trackLayout Layout to look in.
+ *  \param server Point server that controls the point.
+ *  \param ident Identity of the point.
+ *  \result Pointer to the cell, NULL if there is not one.
+ */
+trackCellDef *findPointCell (trackLayoutDef *trackLayout, int server, int ident)
+{
+	return trackLayout == NULL ? NULL : cellIndexFind (trackLayout, trackLayout -> pointIndex, server, ident);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F I N D  S I G N A L  C E L L                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find the cell with a signal on it.
+ *  \param trackLayout Layout to look in.
+ *  \param server Point server that controls the signal.
+ *  \param ident Identity of the signal.
+ *  \result Pointer to the cell, NULL if there is not one.
+ */
+trackCellDef *findSignalCell (trackLayoutDef *trackLayout, int server, int ident)
+{
+	return trackLayout == NULL ? NULL : cellIndexFind (trackLayout, trackLayout -> signalIndex, server, ident);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  F I N D  S E R V E R  C E L L S                                                                                   *
+ *  ===============================                                                                                   *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Find the list of point and signal cells for a server.
+ *  \param trackLayout Layout to look in.
+ *  \param server Point server to find.
+ *  \result Pointer to the lists, NULL if the server has no cells.
+ */
+serverCellsDef *findServerCells (trackLayoutDef *trackLayout, int server)
+{
+	int s;
+
+	if (trackLayout != NULL && trackLayout -> serverCells != NULL)
+	{
+		for (s = 0; s < trackLayout -> serverCount; ++s)
+		{
+			if (trackLayout -> serverCells[s].server == server)
+				return &trackLayout -> serverCells[s];
+		}
+	}
+	return NULL;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  B U I L D  C E L L  I N D E X                                                                                     *
+ *  =============================                                                                                     *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Index the points and signals by server and ident, and list them for each server, so a change does not
+ *  have to look at every cell in the layout.
+ *  \param trackLayout Layout to index.
+ *  \result 1 if the index was built, 0 if we ran out of memory.
+ */
+int buildCellIndex (trackLayoutDef *trackLayout)
+{
+	int i, s, total = 0, points = 0, signals = 0, size = 16;
+	trackCellDef *cell;
+	cellIterDef iter;
+
+	free (trackLayout -> pointIndex);
+	free (trackLayout -> signalIndex);
+	free (trackLayout -> serverCells);
+	free (trackLayout -> serverCellList);
+	trackLayout -> pointIndex = trackLayout -> signalIndex = NULL;
+	trackLayout -> serverCells = NULL;
+	trackLayout -> serverCellList = NULL;
+	trackLayout -> serverCount = 0;
+
+	for (cell = trackCellFirst (trackLayout, &iter, 0, 0, trackLayout -> trackRows, trackLayout -> trackCols);
+			cell != NULL; cell = trackCellNext (trackLayout, &iter))
+	{
+		if (cell -> point.point)
+			++points;
+		if (cell -> signal.signal)
+			++signals;
+	}
+	while (size < 2 * (points > signals ? points : signals))
+		size *= 2;
+
+	trackLayout -> indexMask = size - 1;
+	trackLayout -> pointIndex = (cellIndexDef *)malloc (size * sizeof (cellIndexDef));
+	trackLayout -> signalIndex = (cellIndexDef *)malloc (size * sizeof (cellIndexDef));
+	trackLayout -> serverCells = (serverCellsDef *)malloc ((points + signals + 1) * sizeof (serverCellsDef));
+	trackLayout -> serverCellList = (trackCellDef **)malloc ((points + signals + 1) * sizeof (trackCellDef *));
+	if (trackLayout -> pointIndex == NULL || trackLayout -> signalIndex == NULL ||
+			trackLayout -> serverCells == NULL || trackLayout -> serverCellList == NULL)
+	{
+		free (trackLayout -> pointIndex);
+		free (trackLayout -> signalIndex);
+		free (trackLayout -> serverCells);
+		free (trackLayout -> serverCellList);
+		trackLayout -> pointIndex = trackLayout -> signalIndex = NULL;
+		trackLayout -> serverCells = NULL;
+		trackLayout -> serverCellList = NULL;
+		return 0;
+	}
+	for (i = 0; i < size; ++i)
+		trackLayout -> pointIndex[i].cell = trackLayout -> signalIndex[i].cell = NULL;
+
+	/*------------------------------------------------------------------------------------------------*
+	 * First pass fills the index and counts the cells for each server, the second fills the lists.   *
+	 *------------------------------------------------------------------------------------------------*/
+	for (cell = trackCellFirst (trackLayout, &iter, 0, 0, trackLayout -> trackRows, trackLayout -> trackCols);
+			cell != NULL; cell = trackCellNext (trackLayout, &iter))
+	{
+		serverCellsDef *server;
+
+		if (cell -> point.point)
+		{
+			cellIndexAdd (trackLayout, trackLayout -> pointIndex, cell -> point.server, cell -> point.ident, cell);
+			if ((server = findServerCells (trackLayout, cell -> point.server)) == NULL)
+			{
+				server = &trackLayout -> serverCells[trackLayout -> serverCount++];
+				memset (server, 0, sizeof (serverCellsDef));
+				server -> server = cell -> point.server;
+			}
+			++server -> pointCount;
+		}
+		if (cell -> signal.signal)
+		{
+			cellIndexAdd (trackLayout, trackLayout -> signalIndex, cell -> signal.server, cell -> signal.ident, cell);
+			if ((server = findServerCells (trackLayout, cell -> signal.server)) == NULL)
+			{
+				server = &trackLayout -> serverCells[trackLayout -> serverCount++];
+				memset (server, 0, sizeof (serverCellsDef));
+				server -> server = cell -> signal.server;
+			}
+			++server -> signalCount;
+		}
+	}
+	for (s = 0; s < trackLayout -> serverCount; ++s)
+	{
+		serverCellsDef *server = &trackLayout -> serverCells[s];
+
+		server -> firstPoint = total;
+		total += server -> pointCount;
+		server -> firstSignal = total;
+		total += server -> signalCount;
+		server -> pointCount = server -> signalCount = 0;
+	}
+	for (cell = trackCellFirst (trackLayout, &iter, 0, 0, trackLayout -> trackRows, trackLayout -> trackCols);
+			cell != NULL; cell = trackCellNext (trackLayout, &iter))
+	{
+		serverCellsDef *server;
+
+		if (cell -> point.point && (server = findServerCells (trackLayout, cell -> point.server)) != NULL)
+			trackLayout -> serverCellList[server -> firstPoint + server -> pointCount++] = cell;
+		if (cell -> signal.signal && (server = findServerCells (trackLayout, cell -> signal.server)) != NULL)
+			trackLayout -> serverCellList[server -> firstSignal + server -> signalCount++] = cell;
+	}
+	return 1;
+}
+
 /**********************************************************************************************************************
  *                                                                                                                    *
  *  P R O C E S S  C E L L S                                                                                          *
@@ -486,13 +1023,18 @@ void processCells (trackCtrlDef *trackCtrl, xmlNode *inNode, int rows, int cols,
 	trackCtrl -> trackLayout -> trackCols = cols;
 	trackCtrl -> trackLayout -> trackSize = size;
 
-	if ((trackCtrl -> trackLayout -> trackCells = (trackCellDef *)malloc (rows * cols * sizeof (trackCellDef))) == NULL)
+	trackCtrl -> trackLayout -> tileRows = (rows + TRACK_TILE_MASK) >> TRACK_TILE_SHIFT;
+	trackCtrl -> trackLayout -> tileCols = (cols + TRACK_TILE_MASK) >> TRACK_TILE_SHIFT;
+
+	if ((trackCtrl -> trackLayout -> trackTiles = (trackTileDef **)malloc (trackCtrl -> trackLayout -> tileRows *
+			trackCtrl -> trackLayout -> tileCols * sizeof (trackTileDef *))) == NULL)
 	{
 		free (trackCtrl -> trackLayout);
 		trackCtrl -> trackLayout = NULL;
 		return;
 	}
-	memset (trackCtrl -> trackLayout -> trackCells, 0, rows * cols * sizeof (trackCellDef));
+	memset (trackCtrl -> trackLayout -> trackTiles, 0, trackCtrl -> trackLayout -> tileRows *
+			trackCtrl -> trackLayout -> tileCols * sizeof (trackTileDef *));
 
 	for (curNode = inNode; curNode; curNode = curNode->next)
 	{
@@ -512,6 +1054,7 @@ void processCells (trackCtrlDef *trackCtrl, xmlNode *inNode, int rows, int cols,
 			}
 		}
 	}
+	buildCellIndex (trackCtrl -> trackLayout);
 }
 
 /**********************************************************************************************************************
@@ -592,6 +1135,26 @@ void parseTree(trackCtrlDef *trackCtrl, xmlNode *inNode, int level)
 					trackCtrl -> idleOff = idleOff * 60;
 					xmlFree (tempStr);
 				}
+				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"txQueue")) != NULL)
+				{
+					int txQueue = 0;
+					sscanf ((char *)tempStr, "%d", &txQueue);
+					trackCtrl -> txQueueSize = txQueue * 1024;
+					xmlFree (tempStr);
+				}
+				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"coalesce")) != NULL)
+				{
+					sscanf ((char *)tempStr, "%d", &trackCtrl -> coalesceTime);
+					xmlFree (tempStr);
+				}
+				if ((tempStr = xmlGetProp(curNode, (const xmlChar*)"slowClient")) != NULL)
+				{
+					if (strcmp ((char *)tempStr, "close") == 0)
+						trackCtrl -> slowClient = SLOW_CLIENT_CLOSE;
+					else
+						trackCtrl -> slowClient = SLOW_CLIENT_DROP;
+					xmlFree (tempStr);
+				}
 				parseTree (trackCtrl, curNode -> children, 1);
 			}
 			else if (level == 1 && strcmp ((char *)curNode->name, "trains") == 0)
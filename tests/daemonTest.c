@@ -0,0 +1,391 @@
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  D A E M O N  T E S T . C                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ *  Copyright (c) 2023 Chris Knight                                                                                   *
+ *                                                                                                                    *
+ *  File daemonTest.c part of TrainControl is free software: you can redistribute it and/or modify it under the       *
+ *  terms of the GNU General Public License as published by the Free Software Foundation, either version 3 of the     *
+ *  License, or (at your option) any later version.                                                                   *
+ *                                                                                                                    *
+ *  TrainControl is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the        *
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for  *
+ *  more details.                                                                                                     *
+ *                                                                                                                    *
+ *  You should have received a copy of the GNU General Public License along with this program. If not, see:           *
+ *  <http://www.gnu.org/licenses/>                                                                                    *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \file
+ *  \brief Checks for the train daemon, it is built in so the tests can get at its queues.
+ */
+#define main trainDaemonMain
+#include "trainDaemon.c"
+#undef main
+
+#define TEST_TRAINS		20
+
+int testFailed = 0;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  C H E C K                                                                                                *
+ *  ==================                                                                                                *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Report the result of one check.
+ *  \param name Name of the check.
+ *  \param passed Set if the check passed.
+ *  \result None.
+ */
+void testCheck (char *name, int passed)
+{
+	printf ("%s %s\n", passed ? "PASS" : "FAIL", name);
+	if (!passed)
+		testFailed = 1;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  H A N D L E                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Make a controller handle for the tests.
+ *  \param socket Socket to use, nothing is sent unless the queues are flushed.
+ *  \result Internal handle.
+ */
+int testHandle (int socket)
+{
+	int handle = allocHandle ();
+
+	HINFO(handle).handle = socket;
+	HINFO(handle).handleType = CONTRL_HTYPE;
+	return handle;
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  Q U E U E D                                                                                              *
+ *  ====================                                                                                              *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Copy out everything queued for a handle and empty its queue.
+ *  \param handle Internal handle.
+ *  \param buffer Buffer to fill.
+ *  \param size Size of the buffer.
+ *  \result Number of bytes copied.
+ */
+int testQueued (int handle, char *buffer, int size)
+{
+	int s, len = 0;
+
+	for (s = 0; s < HINFO(handle).sendCount; ++s)
+	{
+		if (len + HINFO(handle).sendSegs[s].len <= size)
+		{
+			memcpy (&buffer[len], &sendArena[HINFO(handle).sendSegs[s].offset], HINFO(handle).sendSegs[s].len);
+			len += HINFO(handle).sendSegs[s].len;
+		}
+	}
+	HINFO(handle).sendCount = 0;
+	arenaUsed = 0;
+	return len;
+}
+
+/*----------------------------------------------------------------------------------------------------*
+ * Function bitsets read back from <G>, in the same way as the controller does it.                    *
+ *----------------------------------------------------------------------------------------------------*/
+unsigned int gotFuncs[TRAIN_ID_MAX][FUNC_WORDS];
+int gotTrains = 0;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  F U N C T I O N  B I T S                                                                                 *
+ *  =================================                                                                                 *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Handler for <G>, each train is followed by the words of its function bitset.
+ *  \param message Message that was received.
+ *  \param handle Not used.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void testFunctionBits (dccMessageDef *message, int handle, void *userData)
+{
+	int w, i;
+
+	for (w = 1; w + FUNC_WORDS < message -> wordCount; w += FUNC_WORDS + 1)
+	{
+		int trainID = dccWordInt (message, w);
+
+		if (trainID >= 0 && trainID < TRAIN_ID_MAX)
+		{
+			for (i = 0; i < FUNC_WORDS; ++i)
+				gotFuncs[trainID][i] = (unsigned int)dccWordInt (message, w + i + 1);
+			++gotTrains;
+		}
+	}
+}
+
+dccCommandDef testFuncCommands[] =
+{
+	{	'G',	FUNC_WORDS + 2,	-1,	testFunctionBits	},
+	{	0,		0,	-1,	NULL				}
+};
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  F U N C T I O N S                                                                                        *
+ *  ==========================                                                                                        *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Send the function state of some trains with <G> and check it reads back the same.
+ *  \result None.
+ */
+void testFunctions ()
+{
+	static trainCtrlDef trains[TEST_TRAINS];
+	static char buffer[8192];
+	dccDispatchDef dispatch;
+	int t, i, len, handle = testHandle (99), expect = 0, same = 1;
+
+	memset (trains, 0, sizeof (trains));
+	for (t = 0; t < TEST_TRAINS; ++t)
+	{
+		trains[t].trainID = t + 1;
+		if (t % 5 == 4)
+			continue;
+
+		trains[t].funcState[0] = t == 0 ? 0x1a : t == 1 ? 0x0000000a : 0x80000000 | t;
+		trains[t].funcState[1] = t == 1 ? 1 : t == 2 ? 0xffffffff : 0;
+		trains[t].funcState[3] = t == 3 ? 0x80000000 : t;
+		++expect;
+	}
+	trackCtrl.trainCtrl = trains;
+	trackCtrl.trainCount = TEST_TRAINS;
+
+	sendAllFunctions (handle);
+	len = testQueued (handle, buffer, sizeof (buffer));
+
+	memset (gotFuncs, 0, sizeof (gotFuncs));
+	dccDispatchInit (&dispatch, testFuncCommands);
+	testCheck ("function bits all parsed", dccParseBuffer (&dispatch, buffer, len, handle, NULL) == len);
+	testCheck ("function bits every train", gotTrains == expect);
+
+	for (t = 0; t < TEST_TRAINS; ++t)
+	{
+		for (i = 0; i < FUNC_WORDS; ++i)
+		{
+			if (gotFuncs[t + 1][i] != trains[t].funcState[i])
+				same = 0;
+		}
+	}
+	testCheck ("function bits round trip", same);
+
+	trackCtrl.trainCtrl = NULL;
+	trackCtrl.trainCount = 0;
+	HINFO(handle).handle = -1;
+	freeHandle (handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  L A N E  H A S                                                                                           *
+ *  =======================                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check if a message is waiting in a serial lane.
+ *  \param l Lane to look in.
+ *  \param text Message to look for.
+ *  \result 1 if it is there.
+ */
+int testLaneHas (int l, char *text)
+{
+	int i;
+	serialLaneDef *lane = &serialLanes[l];
+
+	for (i = 0; i < lane -> msgCount; ++i)
+	{
+		serialMsgDef *msg = &lane -> msgs[lane -> msgHead + i];
+
+		if (msg -> len == (int)strlen (text) && memcmp (&lane -> buffer[msg -> offset], text, msg -> len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+int gotLane = -1;
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  L A N E                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Handler that saves which serial lane a message would go in.
+ *  \param message Message that was received.
+ *  \param handle Not used.
+ *  \param userData Not used.
+ *  \result None.
+ */
+void testLane (dccMessageDef *message, int handle, void *userData)
+{
+	gotLane = serialPriority (message);
+}
+
+dccCommandDef testLaneCommands[] =
+{
+	{	0,		0,	-1,	testLane			}
+};
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  P R I O R I T Y                                                                                          *
+ *  ========================                                                                                          *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Parse each sort of message and check it would go in the right serial lane.
+ *  \result None.
+ */
+void testPriority ()
+{
+	char *texts[] = { "<!>", "<0>", "<1>", "<s>", "<c>", "<t 1 3 50 1>", "<F 3 1 1>" };
+	int lanes[] = { SERIAL_URGENT, SERIAL_URGENT, SERIAL_CONTROL, SERIAL_POLL, SERIAL_POLL, SERIAL_CONTROL,
+			SERIAL_CONTROL };
+	int i, same = 1;
+	dccDispatchDef dispatch;
+
+	dccDispatchInit (&dispatch, testLaneCommands);
+	for (i = 0; i < 7; ++i)
+	{
+		gotLane = -1;
+		dccParseBuffer (&dispatch, texts[i], strlen (texts[i]), 0, NULL);
+		if (gotLane != lanes[i])
+			same = 0;
+	}
+	testCheck ("serial lanes", same);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  S T O P                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Check a stop drops the older throttles for the same train from the control lane, and power off and
+ *  emergency stop drop them all.
+ *  \result None.
+ */
+void testStop ()
+{
+	spscInit (&serialTxRing, SERIAL_RING_SIZE);
+	serialRunning = 1;
+
+	sendSerial ("<t 1 3 50 1>", 12, SERIAL_CONTROL);
+	sendSerial ("<t 2 4 60 1>", 12, SERIAL_CONTROL);
+	sendSerial ("<F 3 1 1>", 9, SERIAL_CONTROL);
+	sendSerial ("<t 1 3 -1 1>", 12, SERIAL_URGENT);
+	serialTakeQueue ();
+	testCheck ("stop drops own throttle", !testLaneHas (SERIAL_CONTROL, "<t 1 3 50 1>"));
+	testCheck ("stop keeps other throttle", testLaneHas (SERIAL_CONTROL, "<t 2 4 60 1>"));
+	testCheck ("stop keeps functions", testLaneHas (SERIAL_CONTROL, "<F 3 1 1>"));
+	testCheck ("stop is queued", testLaneHas (SERIAL_URGENT, "<t 1 3 -1 1>"));
+
+	sendSerial ("<t 1 3 20 1>", 12, SERIAL_CONTROL);
+	sendSerial ("<!>", 3, SERIAL_URGENT);
+	serialTakeQueue ();
+	testCheck ("emergency stop drops all throttles", !testLaneHas (SERIAL_CONTROL, "<t 1 3 20 1>") &&
+			!testLaneHas (SERIAL_CONTROL, "<t 2 4 60 1>") && testLaneHas (SERIAL_CONTROL, "<F 3 1 1>"));
+
+	sendSerial ("<t 2 4 30 0>", 12, SERIAL_CONTROL);
+	sendSerial ("<0>", 3, SERIAL_URGENT);
+	serialTakeQueue ();
+	testCheck ("power off drops all throttles", !testLaneHas (SERIAL_CONTROL, "<t 2 4 30 0>"));
+
+	serialRunning = 0;
+	spscFree (&serialTxRing);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  T E S T  R I N G                                                                                                  *
+ *  ================                                                                                                  *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Overflow a slow client's queue with frames that have '<' and '>' in their numbers, only whole frames
+ *  must be dropped and the half sent one at the front must be kept.
+ *  \result None.
+ */
+void testRing ()
+{
+	int i, posn, seq, handle = testHandle (-1), whole = 1;
+	char frame[7] = { DCC_FRAME_START, 5, DCC_FRAME_OPCODE, '<', 0, '>', '>' };
+	char ring[64];
+	HANDLEINFO *info = &HINFO(handle);
+
+	trackCtrl.txQueueSize = 50;
+	trackCtrl.slowClient = SLOW_CLIENT_DROP;
+
+	/*------------------------------------------------------------------------------------------------*
+	 * The client has taken 4 bytes of the first frame, so the other 3 must stay at the front.        *
+	 *------------------------------------------------------------------------------------------------*/
+	ringAdd (handle, frame, sizeof (frame));
+	info -> ringHead = 4;
+	info -> ringLen = info -> ringKeep = 3;
+
+	for (i = 1; i <= 20; ++i)
+	{
+		frame[4] = i;
+		ringAdd (handle, frame, sizeof (frame));
+	}
+	for (i = 0; i < info -> ringLen; ++i)
+		ring[i] = info -> ringBuff[(info -> ringHead + i) % info -> ringSize];
+
+	testCheck ("ring keeps half sent frame", info -> ringLen > 3 && memcmp (ring, "\0>>", 3) == 0);
+
+	seq = 20 - ((info -> ringLen - 3) / 7) + 1;
+	for (posn = 3; posn < info -> ringLen; posn += 7, ++seq)
+	{
+		frame[4] = seq;
+		if (dccFrameLength (&ring[posn], info -> ringLen - posn) != 7 || memcmp (&ring[posn], frame, 7) != 0)
+			whole = 0;
+	}
+	testCheck ("ring drops whole frames", whole && posn == info -> ringLen && seq == 21);
+	testCheck ("ring counts dropped frames", info -> dropCount == 20 - ((info -> ringLen - 3) / 7));
+
+	freeHandle (handle);
+}
+
+/**********************************************************************************************************************
+ *                                                                                                                    *
+ *  M A I N                                                                                                           *
+ *  =======                                                                                                           *
+ *                                                                                                                    *
+ **********************************************************************************************************************/
+/**
+ *  \brief Run all the checks.
+ *  \param argc Not used.
+ *  \param argv Not used.
+ *  \result 0 if they all passed.
+ */
+int main (int argc, char *argv[])
+{
+	testFunctions ();
+	testPriority ();
+	testStop ();
+	testRing ();
+	return testFailed;
+}